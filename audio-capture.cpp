@@ -0,0 +1,825 @@
+#include "audio-capture.h"
+
+#include <SDL.h>
+
+#ifdef TRANSCRIBE_WITH_PULSE
+#include <pulse/error.h>
+#include <pulse/simple.h>
+#endif
+
+#ifdef TRANSCRIBE_WITH_ALSA
+#include <alsa/asoundlib.h>
+#endif
+
+#include <algorithm>
+#include <cstdio>
+#include <thread>
+
+// Rate we ask for when opening a device at its native rate. Only SDL reports
+// the rate it really opened; for PulseAudio and ALSA this is what we get,
+// converted by the server or plug layer if the device runs at another rate.
+// Nearly every device and sound server runs at it.
+static const int DEFAULT_DEVICE_RATE = 48000;
+
+// Interleaved channels to open the device with: enough to reach the wanted
+// channel, or mono
+static int capture_channels(const capture_params & params) {
+    return params.channel < 0 ? 1 : params.channel + 1;
+}
+
+// A source of float frames with capture_channels() interleaved channels at the
+// rate given to open(), which it passes to audio_capture::write() from its own
+// thread.
+class capture_backend {
+public:
+    virtual ~capture_backend() {}
+
+    // sample_rate may be changed to what the device actually delivers;
+    // native asks the backend to prefer the device's own rate
+    virtual bool open(const capture_params & params, int & sample_rate, bool native) = 0;
+    virtual bool start() = 0;
+    virtual bool stop() = 0;
+    virtual double latency_ms() = 0;
+
+    // false once the device has gone away (unplugged, or reads failing)
+    virtual bool alive() = 0;
+
+    // name that opens this same device again, even if device indexes change;
+    // empty for the default device
+    virtual std::string device_name() = 0;
+
+    // don't report a device that fails to open (we're probing for it)
+    bool quiet = false;
+};
+
+class sdl_backend : public capture_backend {
+public:
+    sdl_backend(audio_capture & sink) : m_sink(sink) {}
+
+    ~sdl_backend() override {
+        if (m_dev_id_in) {
+            SDL_CloseAudioDevice(m_dev_id_in);
+        }
+    }
+
+    bool open(const capture_params & params, int & sample_rate, bool native) override {
+        if (SDL_Init(SDL_INIT_AUDIO) < 0) {
+            fprintf(stderr, "%s: couldn't initialize SDL: %s\n", __func__, SDL_GetError());
+            return false;
+        }
+
+        SDL_SetHintWithPriority(SDL_HINT_AUDIO_RESAMPLING_MODE, "medium", SDL_HINT_OVERRIDE);
+
+        SDL_AudioSpec capture_spec_requested;
+        SDL_AudioSpec capture_spec_obtained;
+
+        SDL_zero(capture_spec_requested);
+        SDL_zero(capture_spec_obtained);
+
+        capture_spec_requested.freq     = sample_rate;
+        capture_spec_requested.format   = AUDIO_F32;
+        capture_spec_requested.channels = capture_channels(params);
+        capture_spec_requested.samples  = params.period_ms > 0 ? (sample_rate * params.period_ms) / 1000 : 1024;
+        capture_spec_requested.callback = [](void * userdata, uint8_t * stream, int len) {
+            sdl_backend * backend = (sdl_backend *) userdata;
+            backend->m_sink.write((const float *) stream, len / (sizeof(float) * backend->m_channels));
+        };
+        capture_spec_requested.userdata = this;
+
+        // a name survives replugging; an index may not
+        const char * device_name = nullptr;
+        if (!params.device.empty()) {
+            device_name = params.device.c_str();
+        } else if (params.capture_id >= 0) {
+            device_name = SDL_GetAudioDeviceName(params.capture_id, SDL_TRUE);
+        }
+        const int allowed_changes = native ? SDL_AUDIO_ALLOW_FREQUENCY_CHANGE : 0;
+        m_dev_id_in = SDL_OpenAudioDevice(device_name, SDL_TRUE, &capture_spec_requested, &capture_spec_obtained, allowed_changes);
+        if (!m_dev_id_in) {
+            if (!quiet) {
+                fprintf(stderr, "%s: couldn't open an audio device for capture: %s\n", __func__, SDL_GetError());
+            }
+            m_dev_id_in = 0;
+            return false;
+        }
+        m_name = device_name ? device_name : "";
+
+        sample_rate = capture_spec_obtained.freq;
+        m_channels = capture_spec_obtained.channels;
+        m_buffer_ms = capture_spec_obtained.samples * 1000.0 / capture_spec_obtained.freq;
+        return true;
+    }
+
+    bool start() override {
+        SDL_PauseAudioDevice(m_dev_id_in, 0);
+        return true;
+    }
+
+    bool stop() override {
+        SDL_PauseAudioDevice(m_dev_id_in, 1);
+        return true;
+    }
+
+    // SDL doesn't report device latency; the callback buffer is what we add
+    double latency_ms() override {
+        return m_buffer_ms;
+    }
+
+    // SDL stops a device that's been disconnected
+    bool alive() override {
+        return SDL_GetAudioDeviceStatus(m_dev_id_in) != SDL_AUDIO_STOPPED;
+    }
+
+    std::string device_name() override {
+        return m_name;
+    }
+
+private:
+    audio_capture & m_sink;
+    std::string m_name;
+    SDL_AudioDeviceID m_dev_id_in = 0;
+    int m_channels = 1;
+    double m_buffer_ms = -1.0;
+};
+
+// Backends with a blocking read, run on a capture thread of our own
+class threaded_backend : public capture_backend {
+public:
+    // derived classes must stop() in their destructor, before closing the device
+    threaded_backend(audio_capture & sink) : m_sink(sink) {}
+
+    bool start() override {
+        if (m_reading) {
+            return true;
+        }
+        m_reading = true;
+        m_thread = std::thread([this]() {
+            std::vector<float> buffer(m_period_samples * m_channels);
+            while (m_reading) {
+                if (!read(buffer.data(), m_period_samples)) {
+                    fprintf(stderr, "%s: capture read failed, stopping\n", __func__);
+                    m_failed = true;
+                    break;
+                }
+                m_sink.write(buffer.data(), m_period_samples);
+            }
+        });
+        return true;
+    }
+
+    // returns within one period, when the read in progress completes
+    bool stop() override {
+        m_reading = false;
+        if (m_thread.joinable()) {
+            m_thread.join();
+        }
+        return true;
+    }
+
+    bool alive() override {
+        return !m_failed;
+    }
+
+    std::string device_name() override {
+        return m_name;
+    }
+
+protected:
+    // fill n_frames frames of m_channels samples, blocking as needed; false on
+    // unrecoverable error
+    virtual bool read(float * frames, size_t n_frames) = 0;
+
+    size_t m_period_samples = 0;  // frames per read
+    int    m_channels = 1;
+    std::string m_name;
+
+private:
+    audio_capture & m_sink;
+    std::thread m_thread;
+    std::atomic_bool m_reading{false};
+    std::atomic_bool m_failed{false};
+};
+
+// Default period for the threaded backends
+static const int DEFAULT_PERIOD_MS = 20;
+
+#ifdef TRANSCRIBE_WITH_PULSE
+class pulse_backend : public threaded_backend {
+public:
+    pulse_backend(audio_capture & sink) : threaded_backend(sink) {}
+
+    ~pulse_backend() override {
+        stop();
+        if (m_pa) {
+            pa_simple_free(m_pa);
+        }
+    }
+
+    bool open(const capture_params & params, int & sample_rate, bool native) override {
+        (void) native;  // the server converts to whatever we ask for
+        pa_sample_spec spec;
+        spec.format   = PA_SAMPLE_FLOAT32LE;
+        spec.rate     = sample_rate;
+        spec.channels = capture_channels(params);
+        m_channels    = spec.channels;
+
+        const int period_ms = params.period_ms > 0 ? params.period_ms : DEFAULT_PERIOD_MS;
+        m_period_samples = (sample_rate * period_ms) / 1000;
+
+        // ask the server to hand over audio once per period
+        pa_buffer_attr attr;
+        attr.maxlength = (uint32_t) -1;
+        attr.tlength   = (uint32_t) -1;
+        attr.prebuf    = (uint32_t) -1;
+        attr.minreq    = (uint32_t) -1;
+        attr.fragsize  = m_period_samples * m_channels * sizeof(float);
+
+        int error = 0;
+        m_pa = pa_simple_new(nullptr, "whisper-transcribe", PA_STREAM_RECORD,
+                             params.device.empty() ? nullptr : params.device.c_str(),
+                             "transcription", &spec, nullptr, &attr, &error);
+        if (!m_pa) {
+            if (!quiet) {
+                fprintf(stderr, "%s: couldn't open PulseAudio source: %s\n", __func__, pa_strerror(error));
+            }
+            return false;
+        }
+        m_name = params.device;
+        return true;
+    }
+
+    bool start() override {
+        int error = 0;
+        pa_simple_flush(m_pa, &error);  // drop what piled up while paused
+        return threaded_backend::start();
+    }
+
+    double latency_ms() override {
+        int error = 0;
+        const pa_usec_t latency = pa_simple_get_latency(m_pa, &error);
+        return latency == (pa_usec_t) -1 ? -1.0 : latency / 1000.0;
+    }
+
+protected:
+    bool read(float * frames, size_t n_frames) override {
+        int error = 0;
+        if (pa_simple_read(m_pa, frames, n_frames * m_channels * sizeof(float), &error) < 0) {
+            fprintf(stderr, "%s: pa_simple_read failed: %s\n", __func__, pa_strerror(error));
+            return false;
+        }
+        return true;
+    }
+
+private:
+    pa_simple * m_pa = nullptr;
+};
+#endif
+
+#ifdef TRANSCRIBE_WITH_ALSA
+class alsa_backend : public threaded_backend {
+public:
+    alsa_backend(audio_capture & sink) : threaded_backend(sink) {}
+
+    ~alsa_backend() override {
+        stop();
+        if (m_pcm) {
+            snd_pcm_close(m_pcm);
+        }
+    }
+
+    bool open(const capture_params & params, int & sample_rate, bool native) override {
+        (void) native;  // plug devices convert; hw devices fail unless the rate is native
+        const char * name = params.device.empty() ? "default" : params.device.c_str();
+        int err = snd_pcm_open(&m_pcm, name, SND_PCM_STREAM_CAPTURE, 0);
+        if (err < 0) {
+            if (!quiet) {
+                fprintf(stderr, "%s: couldn't open ALSA device %s: %s\n", __func__, name, snd_strerror(err));
+            }
+            m_pcm = nullptr;
+            return false;
+        }
+
+        // snd_pcm_set_params splits the buffer into four periods
+        const int period_ms = params.period_ms > 0 ? params.period_ms : DEFAULT_PERIOD_MS;
+        m_channels = capture_channels(params);
+        err = snd_pcm_set_params(m_pcm, SND_PCM_FORMAT_FLOAT_LE, SND_PCM_ACCESS_RW_INTERLEAVED,
+                                 m_channels, sample_rate, 1, 4 * period_ms * 1000);
+        if (err < 0) {
+            fprintf(stderr, "%s: couldn't configure ALSA device %s: %s\n", __func__, name, snd_strerror(err));
+            return false;
+        }
+
+        m_sample_rate = sample_rate;
+        m_period_samples = (sample_rate * period_ms) / 1000;
+        m_name = params.device;
+        return true;
+    }
+
+    bool start() override {
+        snd_pcm_prepare(m_pcm);
+        return threaded_backend::start();
+    }
+
+    bool stop() override {
+        threaded_backend::stop();
+        if (m_pcm) {
+            snd_pcm_drop(m_pcm);
+        }
+        return true;
+    }
+
+    double latency_ms() override {
+        snd_pcm_sframes_t delay = 0;
+        if (snd_pcm_delay(m_pcm, &delay) < 0) {
+            return -1.0;
+        }
+        return delay * 1000.0 / m_sample_rate;
+    }
+
+protected:
+    bool read(float * frames, size_t n_frames) override {
+        while (n_frames > 0) {
+            snd_pcm_sframes_t n = snd_pcm_readi(m_pcm, frames, n_frames);
+            if (n < 0) {
+                // xruns (-EPIPE) and suspends are recoverable
+                fprintf(stderr, "%s: snd_pcm_readi: %s\n", __func__, snd_strerror((int) n));
+                if (snd_pcm_recover(m_pcm, (int) n, 1) < 0) {
+                    return false;
+                }
+                continue;
+            }
+            frames += n * m_channels;
+            n_frames -= n;
+        }
+        return true;
+    }
+
+private:
+    snd_pcm_t * m_pcm = nullptr;
+    int m_sample_rate = 0;
+};
+#endif
+
+// Audio is pushed in by the application with audio_capture::write(), e.g.
+// from an embedding host through libtranscribe, rather than read from a
+// device; there is no device to lose, so the monitor doesn't run.
+class push_backend : public capture_backend {
+public:
+    bool open(const capture_params & params, int & sample_rate, bool native) override {
+        if (native) {
+            sample_rate = params.sample_rate;
+        }
+        return true;
+    }
+    bool start() override { return true; }
+    bool stop() override { return true; }
+    double latency_ms() override { return 0.0; }
+    bool alive() override { return true; }
+    std::string device_name() override { return ""; }
+};
+
+std::string audio_capture_backends() {
+    std::string backends = "sdl";
+#ifdef TRANSCRIBE_WITH_PULSE
+    backends += ", pulse";
+#endif
+#ifdef TRANSCRIBE_WITH_ALSA
+    backends += ", alsa";
+#endif
+    return backends;
+}
+
+audio_capture::audio_capture(int len_ms) {
+    m_len_ms = len_ms;
+    m_running = false;
+}
+
+audio_capture::~audio_capture() {
+    // stop the monitor and the backend's thread before the ring goes away
+    pause();
+    m_backend.reset();
+}
+
+// How often the monitor checks the device, how long without samples counts
+// as lost (for backends that don't notice), and how often we try to get back
+// from the default device to the one asked for
+static const int MONITOR_INTERVAL_MS = 500;
+static const int CAPTURE_STALL_MS = 2000;
+static const int PREFERRED_PROBE_MS = 2000;
+
+static int64_t steady_now_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static bool is_default_device(const capture_params & params) {
+    return params.device.empty() && params.capture_id < 0;
+}
+
+static std::string device_label(const capture_params & params) {
+    return is_default_device(params) ? "default device" : "'" + params.device + "'";
+}
+
+std::unique_ptr<capture_backend> audio_capture::open_backend(const capture_params & params, int & device_rate, bool quiet) {
+    std::unique_ptr<capture_backend> backend;
+    if (params.backend == "sdl") {
+        backend.reset(new sdl_backend(*this));
+    }
+    else if (params.backend == "push") {
+        backend.reset(new push_backend());
+    }
+#ifdef TRANSCRIBE_WITH_PULSE
+    else if (params.backend == "pulse") {
+        backend.reset(new pulse_backend(*this));
+    }
+#endif
+#ifdef TRANSCRIBE_WITH_ALSA
+    else if (params.backend == "alsa") {
+        backend.reset(new alsa_backend(*this));
+    }
+#endif
+    else {
+        fprintf(stderr, "%s: capture backend '%s' not available (built with: %s)\n",
+                __func__, params.backend.c_str(), audio_capture_backends().c_str());
+        return nullptr;
+    }
+
+    const bool native = params.device_rate <= 0;
+    device_rate = native ? DEFAULT_DEVICE_RATE : params.device_rate;
+    backend->quiet = quiet;
+    if (!backend->open(params, device_rate, native)) {
+        return nullptr;
+    }
+    return backend;
+}
+
+void audio_capture::set_device_rate(int device_rate) {
+    m_device_rate = device_rate;
+    if (m_device_rate != m_sample_rate) {
+        m_resampler.reset(new resampler(m_device_rate, m_sample_rate));
+    } else {
+        m_resampler.reset();
+    }
+}
+
+bool audio_capture::init(const capture_params & params) {
+    int device_rate = 0;
+    m_backend = open_backend(params, device_rate, false);
+    if (!m_backend) {
+        return false;
+    }
+
+    // reopen by name from now on
+    m_params = params;
+    m_params.device = m_backend->device_name();
+    m_params.capture_id = -1;
+    m_on_fallback = false;
+
+    m_sample_rate = params.sample_rate;
+    m_channels = capture_channels(params);
+    m_channel = std::max(params.channel, 0);
+    set_device_rate(device_rate);
+    if (params.conditioning.enabled()) {
+        m_conditioner.reset(new conditioner(m_sample_rate, params.conditioning));
+    } else {
+        m_conditioner.reset();
+    }
+
+    m_audio.assign((m_sample_rate * m_len_ms) / 1000, 0.0f);
+    m_total = 0;
+    m_oldest = 0;
+    m_consumed = 0;
+    m_overruns = overrun_stats();
+    m_gaps = gap_stats();
+
+    return true;
+}
+
+bool audio_capture::resume() {
+    std::lock_guard<std::mutex> lock(m_backend_mutex);
+    if (!m_backend) {
+        fprintf(stderr, "%s: no audio device to resume!\n", __func__);
+        return false;
+    }
+
+    if (m_running) {
+        return true;
+    }
+
+    m_running = true;
+    m_last_write_ms = steady_now_ms();
+    if (!m_backend->start()) {
+        m_running = false;
+        return false;
+    }
+
+    if (m_params.backend != "push") {
+        m_monitor_stop = false;
+        m_monitor = std::thread(&audio_capture::monitor, this);
+    }
+
+    return true;
+}
+
+bool audio_capture::pause() {
+    {
+        std::lock_guard<std::mutex> lock(m_backend_mutex);
+        m_monitor_stop = true;
+        m_monitor_cond.notify_all();
+    }
+    if (m_monitor.joinable()) {
+        m_monitor.join();
+    }
+
+    std::lock_guard<std::mutex> lock(m_backend_mutex);
+    if (!m_running) {
+        return true;
+    }
+
+    // the device may have gone away and not come back yet
+    if (m_backend) {
+        m_backend->stop();
+    }
+    m_running = false;
+
+    return true;
+}
+
+// Open params' device and switch capture over to it. Called by the monitor
+// with m_backend_mutex held; the old backend is stopped before the new one
+// starts, so only one capture thread ever writes. lost_ms is when the
+// previous device stopped delivering audio, or negative if it didn't.
+bool audio_capture::switch_device(const capture_params & params, int64_t lost_ms) {
+    int device_rate = 0;
+    std::unique_ptr<capture_backend> backend = open_backend(params, device_rate, true);
+    if (!backend) {
+        return false;
+    }
+
+    if (m_backend) {
+        m_backend->stop();
+    }
+    m_backend = std::move(backend);
+
+    // filter state belongs to the old device's audio
+    set_device_rate(device_rate);
+    if (m_conditioner) {
+        m_conditioner->reset();
+    }
+
+    // Stand in for the missing audio with silence, up to the ring's length,
+    // so a segment in progress ends instead of being spliced to what comes next
+    if (lost_ms >= 0) {
+        const double gap_ms = (double) (steady_now_ms() - lost_ms);
+        const size_t n_silence = std::min<size_t>((size_t) (gap_ms * m_sample_rate / 1000.0), m_audio.size());
+        write_ring(std::vector<float>(n_silence, 0.0f).data(), n_silence);
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_gaps.n_gaps++;
+        m_gaps.total_ms += gap_ms;
+        m_gaps.last_ms = gap_ms;
+    }
+
+    m_last_write_ms = steady_now_ms();
+    return m_backend->start();
+}
+
+void audio_capture::monitor() {
+    std::unique_lock<std::mutex> lock(m_backend_mutex);
+    int64_t next_probe_ms = steady_now_ms() + PREFERRED_PROBE_MS;
+
+    while (!m_monitor_stop) {
+        m_monitor_cond.wait_for(lock, std::chrono::milliseconds(MONITOR_INTERVAL_MS));
+        if (m_monitor_stop) {
+            break;
+        }
+
+        const int64_t now_ms = steady_now_ms();
+        const bool stalled = now_ms - m_last_write_ms > CAPTURE_STALL_MS;
+        if (m_backend->alive() && !stalled) {
+            // running on the default device; see if the one asked for is back
+            if (m_on_fallback && now_ms >= next_probe_ms) {
+                next_probe_ms = now_ms + PREFERRED_PROBE_MS;
+                if (switch_device(m_params, -1)) {
+                    m_on_fallback = false;
+                    fprintf(stderr, "%s: %s is back, capturing from it again\n", __func__, device_label(m_params).c_str());
+                }
+            }
+            continue;
+        }
+
+        // The device is gone: keep trying the one asked for, then the default
+        const int64_t lost_ms = m_last_write_ms;
+        fprintf(stderr, "%s: capture device %s %s, reopening\n", __func__,
+                device_label(m_on_fallback ? capture_params() : m_params).c_str(),
+                stalled ? "stopped delivering audio" : "was lost");
+        m_backend->stop();
+
+        capture_params fallback = m_params;
+        fallback.device.clear();
+        fallback.capture_id = -1;
+        bool reopened = false;
+        while (!m_monitor_stop && !reopened) {
+            if (switch_device(m_params, lost_ms)) {
+                m_on_fallback = false;
+                reopened = true;
+            } else if (!is_default_device(m_params) && switch_device(fallback, lost_ms)) {
+                m_on_fallback = true;
+                reopened = true;
+            } else {
+                m_monitor_cond.wait_for(lock, std::chrono::milliseconds(MONITOR_INTERVAL_MS));
+            }
+        }
+        if (!reopened) {
+            break;
+        }
+
+        fprintf(stderr, "%s: capturing from %s after a %.1f s gap\n", __func__,
+                device_label(m_on_fallback ? fallback : m_params).c_str(), gaps().last_ms / 1000.0);
+        next_probe_ms = steady_now_ms() + PREFERRED_PROBE_MS;
+    }
+}
+
+double audio_capture::latency_ms() {
+    std::lock_guard<std::mutex> lock(m_backend_mutex);
+    if (!m_backend) {
+        return -1.0;
+    }
+
+    double latency = m_backend->latency_ms();
+    if (latency >= 0.0 && m_resampler) {
+        // the filter is symmetric, so it delays by half its length
+        latency += 0.5 * m_resampler->taps() * 1000.0 / m_device_rate;
+    }
+    return latency;
+}
+
+void audio_capture::write(const float * frames, size_t n_frames) {
+    if (!m_running) {
+        return;
+    }
+    m_last_write_ms = steady_now_ms();
+
+    const float * samples = frames;
+    size_t n_samples = n_frames;
+    if (m_channels > 1) {
+        m_channel_samples.resize(n_frames);
+        for (size_t i = 0; i < n_frames; ++i) {
+            m_channel_samples[i] = frames[i * m_channels + m_channel];
+        }
+        samples = m_channel_samples.data();
+    }
+
+    if (!m_resampler && !m_conditioner) {
+        write_ring(samples, n_samples);
+        return;
+    }
+
+    m_resampled.clear();
+    if (m_resampler) {
+        m_resampler->process(samples, n_samples, m_resampled);
+    } else {
+        m_resampled.assign(samples, samples + n_samples);
+    }
+    if (m_conditioner) {
+        m_conditioner->process(m_resampled.data(), m_resampled.size());
+    }
+    write_ring(m_resampled.data(), m_resampled.size());
+}
+
+void audio_capture::write_ring(const float * samples, size_t n_samples) {
+    if (n_samples == 0) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    const size_t capacity = m_audio.size();
+    if (n_samples > capacity) {
+        m_total += n_samples - capacity;
+        samples += n_samples - capacity;
+        n_samples = capacity;
+    }
+
+    // after this write the ring starts at m_total + n_samples - capacity
+    if (m_total + n_samples > m_consumed + capacity) {
+        const uint64_t lost_begin = m_consumed;
+        const uint64_t lost_end = m_total + n_samples - capacity;
+        m_overruns.n_overruns++;
+        m_overruns.n_lost += lost_end - lost_begin;
+        m_overruns.last_pos = lost_begin;
+        m_overruns.last_n_lost = lost_end - lost_begin;
+        m_overruns.last_time = std::chrono::system_clock::now();
+        m_consumed = lost_end;
+    }
+
+    // write in at most two pieces, wrapping at the end of the ring
+    const size_t offset = m_total % capacity;
+    const size_t n0 = std::min(n_samples, capacity - offset);
+    std::copy(samples, samples + n0, m_audio.begin() + offset);
+    std::copy(samples + n0, samples + n_samples, m_audio.begin());
+
+    m_total += n_samples;
+    m_oldest = std::max(m_oldest, m_total > capacity ? m_total - capacity : 0);
+
+    if (m_total >= m_wait_pos) {
+        m_wait_pos = UINT64_MAX;
+        m_cond.notify_all();
+    }
+}
+
+uint64_t audio_capture::position() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_total;
+}
+
+bool audio_capture::wait(uint64_t pos) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (m_total < pos && !m_interrupted) {
+        m_wait_pos = pos;
+        m_room_cond.notify_all();
+        m_cond.wait(lock);
+    }
+    return !m_interrupted;
+}
+
+bool audio_capture::wait_for_room(size_t n_samples) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    // A waiting reader needs this write to get going again, whether it fits or not
+    m_room_cond.wait(lock, [&]() {
+        return m_interrupted || m_wait_pos != UINT64_MAX || m_total + n_samples <= m_consumed + m_audio.size();
+    });
+    return !m_interrupted;
+}
+
+void audio_capture::interrupt() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_interrupted = true;
+    m_cond.notify_all();
+    m_room_cond.notify_all();
+}
+
+uint64_t audio_capture::get(uint64_t begin, uint64_t end, std::vector<float> & audio) {
+    audio.clear();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    const size_t capacity = m_audio.size();
+    begin = std::max(begin, m_oldest);
+    end = std::min(end, m_total);
+    if (begin >= end) {
+        return end;
+    }
+
+    const size_t n_samples = end - begin;
+    const size_t offset = begin % capacity;
+    const size_t n0 = std::min(n_samples, capacity - offset);
+    audio.reserve(n_samples);
+    audio.insert(audio.end(), m_audio.begin() + offset, m_audio.begin() + offset + n0);
+    audio.insert(audio.end(), m_audio.begin(), m_audio.begin() + (n_samples - n0));
+
+    return begin;
+}
+
+void audio_capture::consume(uint64_t pos) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_consumed = std::max(m_consumed, std::min(pos, m_total));
+    m_room_cond.notify_all();
+}
+
+void audio_capture::resize(int len_ms) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    const size_t old_capacity = m_audio.size();
+    const size_t new_capacity = ((size_t) m_sample_rate * len_ms) / 1000;
+    if (new_capacity == 0 || new_capacity == old_capacity) {
+        return;
+    }
+
+    // re-home the samples we keep at their position modulo the new length
+    std::vector<float> audio(new_capacity, 0.0f);
+    const uint64_t n_keep = std::min<uint64_t>(m_total - m_oldest, new_capacity);
+    for (uint64_t pos = m_total - n_keep; pos < m_total; ++pos) {
+        audio[pos % new_capacity] = m_audio[pos % old_capacity];
+    }
+    m_oldest = m_total - n_keep;
+
+    m_audio.swap(audio);
+    m_len_ms = len_ms;
+    m_room_cond.notify_all();
+}
+
+int audio_capture::len_ms() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_len_ms;
+}
+
+audio_capture::overrun_stats audio_capture::overruns() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_overruns;
+}
+
+audio_capture::gap_stats audio_capture::gaps() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_gaps;
+}
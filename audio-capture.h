@@ -0,0 +1,182 @@
+// Audio capture into a ring buffer addressed by absolute sample position
+//
+// Like audio_async from whisper.cpp's common-sdl, but the ring keeps running
+// between reads and readers ask for a range of absolute sample positions
+// rather than "the last N ms". That way nothing is counted twice or skipped
+// between polls, and callers can reach back to audio from before they noticed
+// speech, up to the length of the ring.
+//
+// The reader reports how far it has consumed. If the backend has to
+// overwrite samples that haven't been consumed yet (the reader was busy for
+// longer than the ring lasts), that's an overrun: the samples are lost, and we
+// count them so the loss never goes unnoticed.
+//
+// Readers block in wait() until the audio they need has been captured; the
+// writer only signals once the requested position is reached, so a waiting
+// reader sees one wakeup per step instead of polling.
+//
+// Audio comes from one of several backends: SDL (always available), or,
+// when built with them, PulseAudio's simple API and raw ALSA, which deliver
+// mono float samples straight into the ring with a configurable period. The
+// push backend has no device at all: the application feeds the ring itself
+// through write(), from one thread at a time, and can wait_for_room() first so
+// it never gets further ahead of the reader than the ring holds.
+//
+// A single channel can be taken from a multichannel device, so each input of
+// an audio interface can be captured (and transcribed) on its own.
+//
+// By default the device is opened at 48 kHz and we resample to the ring's rate
+// ourselves (see resampler in audio-dsp.h). SDL may switch to the device's own
+// rate, so with SDL the backend never resamples. PulseAudio and the ALSA plug
+// layer don't say what the device runs at; they deliver the 48 kHz we ask for
+// and convert themselves if the device runs at another rate. Optional
+// conditioning (high-pass, noise gate, AGC) is applied after resampling, so
+// everything read from the ring has had it.
+//
+// While capturing, a monitor thread watches for the device going away
+// (unplugged, or no audio for a while) and reopens it by name, falling back
+// to the default device until the one asked for comes back. The gap is
+// filled with silence and counted.
+
+#pragma once
+
+#include "audio-dsp.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct capture_params {
+    std::string backend = "sdl";  // sdl, pulse, alsa or push
+    int capture_id = -1;          // SDL device index (-1 = default)
+    std::string device;           // device name; takes precedence over capture_id (empty = default)
+    int sample_rate = 16000;      // rate of the samples in the ring
+    int device_rate = 0;          // rate to open the device at (0 = native with SDL, 48000 otherwise)
+    int period_ms = 0;            // samples delivered per backend read/callback (0 = backend default)
+    int channel = -1;             // channel of a multichannel device to capture (-1 = open it as mono)
+    conditioner_params conditioning;
+};
+
+// backends compiled into this binary, e.g. "sdl, pulse, alsa"
+std::string audio_capture_backends();
+
+class capture_backend;
+
+class audio_capture {
+public:
+    audio_capture(int len_ms);
+    ~audio_capture();
+
+    bool init(const capture_params & params);
+
+    // start/stop capturing audio; the ring keeps its contents while paused
+    bool resume();
+    bool pause();
+
+    // called by the backend's capture thread (or, with the push backend, the
+    // application) with newly captured frames at device_rate(), interleaved
+    // when capturing one channel of several
+    void write(const float * frames, size_t n_frames);
+
+    int sample_rate() const { return m_sample_rate; }
+    int device_rate() const { return m_device_rate; }
+
+    // delay between sound reaching the device and its samples reaching the
+    // ring, as reported by the backend; negative if unknown
+    double latency_ms();
+
+    // number of samples captured since init; the newest sample is position() - 1
+    uint64_t position();
+
+    // block until position() >= pos; returns false if interrupted
+    bool wait(uint64_t pos);
+
+    // block until n_samples more (at sample_rate()) fit without overwriting
+    // unconsumed audio, or the reader is waiting for more than the ring holds;
+    // returns false if interrupted
+    bool wait_for_room(size_t n_samples);
+
+    // wake up wait() and wait_for_room() and make them return false from now on
+    void interrupt();
+
+    // copy samples [begin, end) into audio, clamped to what the ring still
+    // holds; returns the position of the first sample copied
+    uint64_t get(uint64_t begin, uint64_t end, std::vector<float> & audio);
+
+    // mark samples before pos as consumed; overwriting them is not an overrun
+    void consume(uint64_t pos);
+
+    // change the ring length, keeping as much captured audio as fits
+    void resize(int len_ms);
+    int len_ms();
+
+    struct overrun_stats {
+        uint64_t n_overruns = 0;    // writes that overwrote unconsumed audio
+        uint64_t n_lost = 0;        // unconsumed samples overwritten
+        uint64_t last_pos = 0;      // position of the first sample lost in the latest overrun
+        uint64_t last_n_lost = 0;   // samples lost in the latest overrun
+        std::chrono::system_clock::time_point last_time;
+    };
+    overrun_stats overruns();
+
+    struct gap_stats {
+        uint64_t n_gaps = 0;    // times the device was lost and reopened
+        double total_ms = 0.0;  // time without audio over all gaps
+        double last_ms = 0.0;
+    };
+    gap_stats gaps();
+
+private:
+    void write_ring(const float * samples, size_t n_samples);
+
+    std::unique_ptr<capture_backend> open_backend(const capture_params & params, int & device_rate, bool quiet);
+    void set_device_rate(int device_rate);
+    bool switch_device(const capture_params & params, int64_t lost_ms);
+    void monitor();
+
+    // m_backend_mutex guards the backend, which the monitor may replace
+    std::unique_ptr<capture_backend> m_backend;
+    std::mutex                       m_backend_mutex;
+    capture_params                   m_params;       // the device asked for, by name
+    bool                             m_on_fallback = false;
+
+    std::thread             m_monitor;
+    std::condition_variable m_monitor_cond;
+    bool                    m_monitor_stop = false;
+    std::atomic<int64_t>    m_last_write_ms{0};  // steady clock time of the latest samples
+
+    // channel extraction, device_rate -> sample_rate and conditioning, used
+    // only on the capture thread
+    std::unique_ptr<resampler>   m_resampler;
+    std::unique_ptr<conditioner> m_conditioner;
+    std::vector<float>           m_resampled;
+    std::vector<float>           m_channel_samples;
+
+    int m_len_ms = 0;
+    int m_sample_rate = 0;
+    int m_device_rate = 0;
+    int m_channels = 1;  // interleaved channels delivered by the backend
+    int m_channel = 0;   // the one we keep
+
+    std::atomic_bool m_running;
+    std::mutex       m_mutex;
+
+    std::condition_variable m_cond;
+    uint64_t                m_wait_pos = UINT64_MAX;  // position a reader is waiting for
+    std::condition_variable m_room_cond;              // consume() or wait() may have made room
+    bool                    m_interrupted = false;
+
+    std::vector<float> m_audio;
+    uint64_t           m_total = 0;     // samples written since init
+    uint64_t           m_oldest = 0;    // oldest sample still in the ring
+    uint64_t           m_consumed = 0;  // samples before this were consumed by the reader
+
+    overrun_stats m_overruns;
+    gap_stats     m_gaps;
+};
@@ -0,0 +1,267 @@
+#include "audio-dsp.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+// Zero crossings of the sinc kept on each side of the centre, at the lower of
+// the two rates. 16 gives a transition band of about 10% of the output band.
+static const int RESAMPLER_ZERO_CROSSINGS = 16;
+
+// Kaiser window shape; 8.0 keeps the stopband around 80 dB down
+static const double RESAMPLER_KAISER_BETA = 8.0;
+
+// Passband edge as a fraction of the lower Nyquist frequency. Leaves room for
+// the transition band below Nyquist so little aliases back into speech.
+static const double RESAMPLER_CUTOFF = 0.9;
+
+// Zeroth-order modified Bessel function of the first kind
+static double bessel_i0(double x) {
+    double sum = 1.0;
+    double term = 1.0;
+    for (int k = 1; k < 50; ++k) {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+        if (term < 1e-12 * sum) {
+            break;
+        }
+    }
+    return sum;
+}
+
+// Dot product of two n-float arrays, n a multiple of 8. Eight independent
+// partial sums let -O3 keep them in vector registers (SSE/AVX/NEON) instead of
+// serialising on a single accumulator.
+static inline float dot8(const float * a, const float * b, int n) {
+    float acc[8] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+    for (int k = 0; k < n; k += 8) {
+        for (int j = 0; j < 8; ++j) {
+            acc[j] += a[k + j] * b[k + j];
+        }
+    }
+    return ((acc[0] + acc[4]) + (acc[1] + acc[5])) + ((acc[2] + acc[6]) + (acc[3] + acc[7]));
+}
+
+resampler::resampler(int in_rate, int out_rate) {
+    m_in_rate = in_rate;
+    m_out_rate = out_rate;
+
+    const int g = std::gcd(in_rate, out_rate);
+    m_up = out_rate / g;
+    m_down = in_rate / g;
+
+    // Prototype low-pass at the upsampled rate in_rate * m_up, cutting off
+    // below the lower of the two Nyquist frequencies.
+    const int ratio = std::max(m_up, m_down);
+    const double fc = RESAMPLER_CUTOFF * 0.5 / ratio;  // cycles per upsampled sample
+    const int half_taps = (int) std::ceil((double) RESAMPLER_ZERO_CROSSINGS * ratio / m_up);
+    m_taps = ((2 * half_taps + 7) / 8) * 8;
+
+    const int n = m_taps * m_up;
+    const double centre = (n - 1) / 2.0;
+    const double i0_beta = bessel_i0(RESAMPLER_KAISER_BETA);
+    std::vector<double> h(n);
+    for (int i = 0; i < n; ++i) {
+        const double t = i - centre;
+        const double x = 2.0 * fc * t;
+        const double sinc = t == 0.0 ? 1.0 : std::sin(M_PI * x) / (M_PI * x);
+        const double r = t / (centre + 1.0);
+        const double window = bessel_i0(RESAMPLER_KAISER_BETA * std::sqrt(std::max(0.0, 1.0 - r * r))) / i0_beta;
+        // m_up restores the gain lost to zero-stuffing
+        h[i] = 2.0 * fc * sinc * window * m_up;
+    }
+
+    // Phase p produces outputs whose position falls p/m_up of the way past an
+    // input sample; its tap j multiplies the input j samples back, which is
+    // prototype coefficient p + j * m_up. Store taps oldest sample first.
+    m_coefs.resize((size_t) m_up * m_taps);
+    for (int p = 0; p < m_up; ++p) {
+        for (int k = 0; k < m_taps; ++k) {
+            const int j = m_taps - 1 - k;
+            m_coefs[(size_t) p * m_taps + k] = (float) h[p + (size_t) j * m_up];
+        }
+    }
+
+    reset();
+}
+
+void resampler::reset() {
+    m_input.assign(m_taps - 1, 0.0f);
+    m_time = (size_t) (m_taps - 1) * m_up;
+}
+
+void resampler::process(const float * samples, size_t n_samples, std::vector<float> & out) {
+    m_input.insert(m_input.end(), samples, samples + n_samples);
+
+    const size_t n_input = m_input.size();
+    while (m_time / m_up < n_input) {
+        const size_t i = m_time / m_up;
+        const size_t phase = m_time % m_up;
+        out.push_back(dot8(&m_coefs[phase * m_taps], &m_input[i + 1 - m_taps], m_taps));
+        m_time += m_down;
+    }
+
+    // keep the history the next output needs; when downsampling the next
+    // output may lie a few samples past the end of the input we have
+    const size_t next = m_time / m_up;
+    const size_t drop = std::min(next + 1 - m_taps, n_input);
+    m_input.erase(m_input.begin(), m_input.begin() + drop);
+    m_time -= drop * m_up;
+}
+
+// Gains are recomputed every this many ms and ramped linearly in between
+static const int CONDITIONER_BLOCK_MS = 10;
+
+// Fourth-order Butterworth high-pass as two biquads; Q of each section. Takes
+// 50 Hz hum down about 16 dB with an 80 Hz cutoff, where speech has little energy.
+static const double HIGHPASS_Q[] = { 0.54119610, 1.30656296 };
+
+// The noise floor follows quieter blocks quickly and rises at this rate
+// otherwise, so speech doesn't drag it up but a new, louder room does
+static const float NOISE_FLOOR_FALL = 0.5f;
+static const float NOISE_FLOOR_RISE_DB_PER_S = 3.0f;
+
+// A block this far above the noise floor (about +6 dB) counts as signal: it
+// opens the gate and updates the AGC level
+static const float SIGNAL_RATIO = 2.0f;
+
+// Closed gate attenuation (-20 dB), how long it stays open after the last
+// signal block, and how fast it closes (per block)
+static const float GATE_ATTENUATION = 0.1f;
+static const int   GATE_HOLD_MS = 200;
+static const float GATE_CLOSE = 0.2f;
+
+// AGC target speech RMS (-20 dBFS), gain limits, and how fast the speech level
+// estimate follows new signal blocks (per block, about 200 ms)
+static const float AGC_TARGET_RMS = 0.1f;
+static const float AGC_MIN_GAIN = 0.25f;
+static const float AGC_MAX_GAIN = 10.0f;
+static const float AGC_LEVEL_ALPHA = 0.05f;
+
+// Largest sample magnitude after gain; the AGC backs off to stay under it
+static const float AGC_PEAK_LIMIT = 0.98f;
+
+conditioner::conditioner(int sample_rate, const conditioner_params & params) {
+    m_params = params;
+    m_block = std::max<size_t>(1, (size_t) sample_rate * CONDITIONER_BLOCK_MS / 1000);
+
+    if (params.highpass_hz > 0.0f) {
+        const double w0 = 2.0 * M_PI * params.highpass_hz / sample_rate;
+        const double cos_w0 = std::cos(w0);
+        for (double q : HIGHPASS_Q) {
+            const double alpha = std::sin(w0) / (2.0 * q);
+            const double a0 = 1.0 + alpha;
+            biquad section;
+            section.b0 = (1.0 + cos_w0) / 2.0 / a0;
+            section.b1 = -(1.0 + cos_w0) / a0;
+            section.b2 = section.b0;
+            section.a1 = -2.0 * cos_w0 / a0;
+            section.a2 = (1.0 - alpha) / a0;
+            m_highpass.push_back(section);
+        }
+    }
+
+    reset();
+}
+
+void conditioner::reset() {
+    for (biquad & section : m_highpass) {
+        section.z1 = section.z2 = 0.0;
+    }
+    m_noise_floor = 0.0f;
+    m_level = 0.0f;
+    m_gate_gain = 1.0f;
+    m_agc_gain = 1.0f;
+    m_gain = 1.0f;
+    m_hold = 0;
+}
+
+float conditioner::gain_db() const {
+    return 20.0f * std::log10(m_agc_gain);
+}
+
+void conditioner::process(float * samples, size_t n_samples) {
+    if (!m_params.enabled()) {
+        return;
+    }
+
+    // The IIR sections are inherently serial; run them over the whole buffer
+    // first, one section at a time
+    for (biquad & s : m_highpass) {
+        double z1 = s.z1, z2 = s.z2;
+        for (size_t i = 0; i < n_samples; ++i) {
+            const double x = samples[i];
+            const double y = s.b0 * x + z1;
+            z1 = s.b1 * x - s.a1 * y + z2;
+            z2 = s.b2 * x - s.a2 * y;
+            samples[i] = (float) y;
+        }
+        s.z1 = z1;
+        s.z2 = z2;
+    }
+
+    if (!m_params.noise_gate && !m_params.agc) {
+        return;
+    }
+
+    for (size_t begin = 0; begin < n_samples; begin += m_block) {
+        apply_block(samples + begin, std::min(m_block, n_samples - begin));
+    }
+}
+
+void conditioner::apply_block(float * samples, size_t n_samples) {
+    // Level and peak, with independent partial sums so -O3 vectorizes
+    float sum[8] = {}, peak[8] = {};
+    size_t i = 0;
+    for (; i + 8 <= n_samples; i += 8) {
+        for (int j = 0; j < 8; ++j) {
+            sum[j] += samples[i + j] * samples[i + j];
+            peak[j] = std::max(peak[j], std::fabs(samples[i + j]));
+        }
+    }
+    for (; i < n_samples; ++i) {
+        sum[0] += samples[i] * samples[i];
+        peak[0] = std::max(peak[0], std::fabs(samples[i]));
+    }
+    const float rms = std::sqrt(std::accumulate(sum, sum + 8, 0.0f) / n_samples);
+    const float block_peak = *std::max_element(peak, peak + 8);
+
+    const float block_sec = n_samples * CONDITIONER_BLOCK_MS / (1000.0f * m_block);
+    if (m_noise_floor <= 0.0f || rms < m_noise_floor) {
+        m_noise_floor += (m_noise_floor <= 0.0f ? 1.0f : NOISE_FLOOR_FALL) * (rms - m_noise_floor);
+    } else {
+        m_noise_floor *= std::pow(10.0f, NOISE_FLOOR_RISE_DB_PER_S * block_sec / 20.0f);
+    }
+    const bool signal = rms > m_noise_floor * SIGNAL_RATIO;
+
+    if (m_params.noise_gate) {
+        if (signal) {
+            m_hold = GATE_HOLD_MS / CONDITIONER_BLOCK_MS;
+            m_gate_gain = 1.0f;
+        } else if (m_hold > 0) {
+            m_hold--;
+        } else {
+            m_gate_gain += GATE_CLOSE * (GATE_ATTENUATION - m_gate_gain);
+        }
+    }
+
+    if (m_params.agc) {
+        if (signal) {
+            m_level += (m_level <= 0.0f ? 1.0f : AGC_LEVEL_ALPHA) * (rms - m_level);
+            m_agc_gain = std::min(std::max(AGC_TARGET_RMS / m_level, AGC_MIN_GAIN), AGC_MAX_GAIN);
+        }
+    }
+
+    float gain = m_gate_gain * m_agc_gain;
+    if (block_peak * gain > AGC_PEAK_LIMIT) {
+        gain = AGC_PEAK_LIMIT / block_peak;
+    }
+
+    // Ramp from the previous block's gain so changes don't click
+    const float g0 = m_gain;
+    const float step = (gain - g0) / n_samples;
+    for (size_t k = 0; k < n_samples; ++k) {
+        samples[k] *= g0 + step * (k + 1);
+    }
+    m_gain = gain;
+}
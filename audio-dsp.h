@@ -0,0 +1,93 @@
+// Audio signal processing for the capture path
+//
+// resampler converts between two fixed sample rates with a windowed-sinc
+// polyphase FIR filter, so we can capture at a device's native rate (44.1 or
+// 48 kHz, usually) and get 16 kHz for VAD and whisper without depending on
+// what the audio backend does internally. It streams: each process() call may
+// get any number of input samples, and filter state carries across calls.
+//
+// conditioner cleans up 16 kHz audio before the VAD and whisper see it: a
+// high-pass filter for DC, rumble and mains hum, a noise gate that pulls audio
+// near the noise floor further down, and automatic gain control that brings
+// speech to a steady level. Each stage is optional. Gains change once per
+// short block and are ramped across it, so they don't click.
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+class resampler {
+public:
+    resampler(int in_rate, int out_rate);
+
+    // append the output for samples to out
+    void process(const float * samples, size_t n_samples, std::vector<float> & out);
+
+    // forget the input history (e.g. after a gap in the input)
+    void reset();
+
+    int in_rate() const { return m_in_rate; }
+    int out_rate() const { return m_out_rate; }
+
+    // filter taps applied per output sample
+    int taps() const { return m_taps; }
+
+private:
+    int m_in_rate;
+    int m_out_rate;
+    int m_up;    // out_rate / gcd
+    int m_down;  // in_rate / gcd
+    int m_taps;  // taps per phase, a multiple of 8
+
+    // m_up phases of m_taps coefficients each, ordered oldest input sample first
+    std::vector<float> m_coefs;
+
+    // input not yet fully used, preceded by m_taps - 1 samples of history
+    std::vector<float> m_input;
+    // position of the next output in m_input, in units of 1/m_up input samples
+    size_t m_time;
+};
+
+struct conditioner_params {
+    float highpass_hz = 0.0f;   // high-pass cutoff (0 = off)
+    bool  noise_gate  = false;  // attenuate audio that stays near the noise floor
+    bool  agc         = false;  // automatic gain control towards a steady speech level
+
+    bool enabled() const { return highpass_hz > 0.0f || noise_gate || agc; }
+};
+
+class conditioner {
+public:
+    conditioner(int sample_rate, const conditioner_params & params);
+
+    // condition samples in place
+    void process(float * samples, size_t n_samples);
+
+    // forget filter state and level estimates
+    void reset();
+
+    // current AGC gain (dB) and noise floor estimate (RMS)
+    float gain_db() const;
+    float noise_floor() const { return m_noise_floor; }
+
+private:
+    // second-order section, transposed direct form II
+    struct biquad {
+        double b0, b1, b2, a1, a2;
+        double z1 = 0.0, z2 = 0.0;
+    };
+
+    void apply_block(float * samples, size_t n_samples);
+
+    conditioner_params m_params;
+    size_t m_block;                 // samples per gain update
+    std::vector<biquad> m_highpass; // cascaded sections, empty when off
+
+    float m_noise_floor;  // RMS of the quietest recent blocks
+    float m_level;        // RMS of recent speech, for the AGC
+    float m_gate_gain;
+    float m_agc_gain;
+    float m_gain;         // gain applied at the end of the last block
+    int   m_hold;         // blocks left before the gate may close
+};
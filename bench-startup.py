@@ -0,0 +1,169 @@
+#!/usr/bin/env python3
+"""Measure how long transcribe takes from spawn to listening, cold and warm.
+
+Runs the binary repeatedly with --startup-timing --exit-when-ready and reports
+min/median/p90/max of each startup phase it prints, plus spawn to ready as
+seen from here (the time from the hotkey's point of view). transcribe only
+knows its own start time to a clock tick, so "spawn to main" and "total" are
+good to about 10 ms; "spawn to ready" is exact.
+
+Cold runs first evict the binary, its shared libraries, the ggml backend
+plugins and the models from the page cache. As root the whole cache is dropped
+instead, which also covers anything else read at startup.
+
+usage: bench-startup.py [--binary PATH] [--runs N] [--warm-only] [-- TRANSCRIBE_ARGS...]
+"""
+
+import os
+import re
+import statistics
+import subprocess
+import sys
+import time
+from pathlib import Path
+from typing import Dict, List
+
+PHASE_RE = re.compile(r"^startup: (.+?)\s+([\d.]+) ms$")
+READY_RE = re.compile(r"^startup: ready at ([\d.]+) s")
+
+# transcribe's defaults, for when the models aren't given on the command line
+MODEL_OPTIONS = {
+    "-m": "models/ggml-base.en.bin",
+    "--vad-model": "models/ggml-silero-v5.1.2.bin",
+    "--fast-model": None,
+}
+
+
+def model_files(args: List[str]) -> List[Path]:
+    """Model files transcribe will load with these arguments"""
+    models = dict(MODEL_OPTIONS)
+    for i, arg in enumerate(args[:-1]):
+        key = "-m" if arg == "--model" else arg
+        if key in models:
+            models[key] = args[i + 1]
+    return [Path(m) for m in models.values() if m]
+
+
+def shared_libraries(binary: Path) -> List[Path]:
+    """Libraries the binary links, and the ggml backend plugins next to them"""
+    libs = set()
+    output = subprocess.run(["ldd", str(binary)], capture_output=True, text=True).stdout
+    for line in output.splitlines():
+        match = re.search(r"=> (/\S+)", line)
+        if match:
+            libs.add(Path(match.group(1)))
+    for lib in list(libs):
+        if lib.name.startswith("libggml"):
+            libs.update(lib.parent.glob("libggml*.so*"))
+    return sorted(libs)
+
+
+def drop_caches() -> bool:
+    """Drop the whole page cache; needs root (and may be refused in a container)"""
+    if os.geteuid() != 0:
+        return False
+    subprocess.run(["sync"], check=True)
+    try:
+        Path("/proc/sys/vm/drop_caches").write_text("3\n")
+    except OSError:
+        return False
+    return True
+
+
+def evict(files: List[Path]) -> None:
+    """Drop files from the page cache (only pages nobody has mapped go)"""
+    if drop_caches():
+        return
+    for path in files:
+        try:
+            fd = os.open(path, os.O_RDONLY)
+        except OSError:
+            continue
+        try:
+            os.posix_fadvise(fd, 0, 0, os.POSIX_FADV_DONTNEED)
+        finally:
+            os.close(fd)
+
+
+def run_once(binary: Path, args: List[str]) -> Dict[str, float]:
+    """Start transcribe once; returns milliseconds per phase"""
+    spawned = time.monotonic()
+    result = subprocess.run(
+        [str(binary.absolute()), "--startup-timing", "--exit-when-ready"] + args,
+        stdout=subprocess.DEVNULL,
+        stderr=subprocess.PIPE,
+        text=True,
+    )
+    if result.returncode != 0:
+        sys.stderr.write(result.stderr)
+        sys.exit(f"error: {binary} exited with status {result.returncode}")
+
+    timings = {}
+    for line in result.stderr.splitlines():
+        match = PHASE_RE.match(line)
+        if match:
+            timings[match.group(1)] = float(match.group(2))
+        match = READY_RE.match(line)
+        if match:
+            # same clock as time.monotonic() on Linux
+            timings["spawn to ready"] = (float(match.group(1)) - spawned) * 1000.0
+    return timings
+
+
+def percentile(values: List[float], p: float) -> float:
+    ordered = sorted(values)
+    return ordered[min(len(ordered) - 1, int(p * len(ordered)))]
+
+
+def report(name: str, runs: List[Dict[str, float]]) -> None:
+    print(f"{name} start, {len(runs)} runs (ms)")
+    print(f"  {'phase':<16} {'min':>8} {'median':>8} {'p90':>8} {'max':>8}")
+    for phase in runs[0]:
+        values = [run[phase] for run in runs if phase in run]
+        print(
+            f"  {phase:<16} {min(values):8.1f} {statistics.median(values):8.1f} "
+            f"{percentile(values, 0.9):8.1f} {max(values):8.1f}"
+        )
+
+
+def main() -> None:
+    argv = sys.argv[1:]
+    args: List[str] = []
+    if "--" in argv:
+        args = argv[argv.index("--") + 1 :]
+        argv = argv[: argv.index("--")]
+
+    binary = Path("build/transcribe")
+    n_runs = 10
+    warm_only = False
+    i = 0
+    while i < len(argv):
+        if argv[i] == "--binary":
+            binary = Path(argv[i + 1])
+            i += 1
+        elif argv[i] == "--runs":
+            n_runs = int(argv[i + 1])
+            i += 1
+        elif argv[i] == "--warm-only":
+            warm_only = True
+        else:
+            sys.exit(__doc__.split("\n\n")[-1].strip())
+        i += 1
+
+    if not warm_only:
+        files = [binary] + shared_libraries(binary) + model_files(args)
+        if not drop_caches():
+            print("note: can't drop the page cache, so evicting only the binary, its libraries and the models")
+        cold = []
+        for _ in range(n_runs):
+            evict(files)
+            cold.append(run_once(binary, args))
+        report("cold", cold)
+
+    # the first run warms the cache and isn't counted
+    run_once(binary, args)
+    report("warm", [run_once(binary, args) for _ in range(n_runs)])
+
+
+if __name__ == "__main__":
+    main()
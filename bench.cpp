@@ -0,0 +1,170 @@
+// Benchmarks for the audio processing done on every captured sample
+//
+// Needs no models or audio devices: runs each stage over synthetic audio and
+// reports its cost per second of audio, plus quality figures where they make
+// sense. Build and run with `make bench`.
+
+#include "audio-dsp.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+static const int OUT_RATE = 16000;
+static const int BENCH_SECONDS = 60;
+static const int CHUNK_MS = 20;  // one capture period
+
+// Sine wave of the given frequency and amplitude
+static std::vector<float> sine(int rate, double freq, double amplitude, int seconds) {
+    std::vector<float> samples((size_t) rate * seconds);
+    for (size_t i = 0; i < samples.size(); ++i) {
+        samples[i] = (float) (amplitude * std::sin(2.0 * M_PI * freq * i / rate));
+    }
+    return samples;
+}
+
+// Run samples through r in capture-sized chunks; returns wall time in seconds
+static double run_chunked(resampler & r, const std::vector<float> & samples, std::vector<float> & out) {
+    const size_t chunk = (size_t) r.in_rate() * CHUNK_MS / 1000;
+    out.clear();
+    out.reserve(samples.size() * OUT_RATE / r.in_rate() + 1);
+    auto t_start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < samples.size(); i += chunk) {
+        r.process(samples.data() + i, std::min(chunk, samples.size() - i), out);
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - t_start).count();
+}
+
+// RMS of out after the filter has settled
+static double settled_rms(const std::vector<float> & out) {
+    const size_t skip = OUT_RATE / 10;
+    double sum = 0.0;
+    for (size_t i = skip; i < out.size(); ++i) {
+        sum += (double) out[i] * out[i];
+    }
+    return std::sqrt(sum / (out.size() - skip));
+}
+
+static void bench_resampler(int in_rate) {
+    resampler r(in_rate, OUT_RATE);
+    std::vector<float> out;
+
+    // speed on white noise
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> noise(-0.5f, 0.5f);
+    std::vector<float> input((size_t) in_rate * BENCH_SECONDS);
+    for (float & x : input) {
+        x = noise(rng);
+    }
+    const double seconds = run_chunked(r, input, out);
+
+    // passband gain at 1 kHz, and what's left of a 10 kHz tone that has to be filtered out
+    resampler r_pass(in_rate, OUT_RATE);
+    run_chunked(r_pass, sine(in_rate, 1000.0, 0.5, 2), out);
+    const double pass_db = 20.0 * std::log10(settled_rms(out) / (0.5 / std::sqrt(2.0)));
+    resampler r_stop(in_rate, OUT_RATE);
+    run_chunked(r_stop, sine(in_rate, 10000.0, 0.5, 2), out);
+    const double stop_db = 20.0 * std::log10(settled_rms(out) / (0.5 / std::sqrt(2.0)) + 1e-12);
+
+    printf("resample %5d -> %d Hz: %3d taps, %7.1f us per second of audio (%6.0fx real time), "
+           "1 kHz %+.3f dB, 10 kHz alias %.1f dB\n",
+           in_rate, OUT_RATE, r.taps(), seconds * 1e6 / BENCH_SECONDS, BENCH_SECONDS / seconds, pass_db, stop_db);
+}
+
+// Quiet room: noise at -50 dBFS with bursts of "speech" (two tones) at the
+// given RMS for the first second of every three
+static const int BURST_PERIOD_S = 3;
+
+static bool in_burst(size_t i) {
+    return (i / OUT_RATE) % BURST_PERIOD_S == 0;
+}
+
+static std::vector<float> room(double speech_rms, double hum_amplitude, int seconds) {
+    std::mt19937 rng(7);
+    std::normal_distribution<float> noise(0.0f, 0.00316f);
+    std::vector<float> samples((size_t) OUT_RATE * seconds);
+    for (size_t i = 0; i < samples.size(); ++i) {
+        const double t = i / (double) OUT_RATE;
+        double x = noise(rng) + hum_amplitude * std::sin(2.0 * M_PI * 50.0 * t);
+        if (in_burst(i)) {
+            x += speech_rms * (std::sin(2.0 * M_PI * 300.0 * t) + std::sin(2.0 * M_PI * 1200.0 * t));
+        }
+        samples[i] = (float) x;
+    }
+    return samples;
+}
+
+// Condition samples in capture-sized chunks; returns wall time in seconds
+static double run_chunked(conditioner & c, std::vector<float> & samples) {
+    const size_t chunk = (size_t) OUT_RATE * CHUNK_MS / 1000;
+    auto t_start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < samples.size(); i += chunk) {
+        c.process(samples.data() + i, std::min(chunk, samples.size() - i));
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - t_start).count();
+}
+
+// RMS (dBFS) of the bursts or of the pauses between them, skipping the first
+// period while levels settle
+static double level_db(const std::vector<float> & samples, bool bursts) {
+    double sum = 0.0;
+    size_t n = 0;
+    for (size_t i = (size_t) OUT_RATE * BURST_PERIOD_S; i < samples.size(); ++i) {
+        if (in_burst(i) == bursts) {
+            sum += (double) samples[i] * samples[i];
+            n++;
+        }
+    }
+    return 10.0 * std::log10(sum / n + 1e-20);
+}
+
+// Gain of the high-pass alone for a tone
+static double tone_gain_db(float highpass_hz, double freq) {
+    conditioner_params params;
+    params.highpass_hz = highpass_hz;
+    conditioner c(OUT_RATE, params);
+    std::vector<float> samples = sine(OUT_RATE, freq, 0.5, 2);
+    run_chunked(c, samples);
+    return 20.0 * std::log10(settled_rms(samples) / (0.5 / std::sqrt(2.0)));
+}
+
+static void bench_conditioner(const char * name, const conditioner_params & params) {
+    // quiet speech (-35 dBFS per tone) over noise and 50 Hz hum
+    const std::vector<float> input = room(0.0178, 0.01, BENCH_SECONDS);
+    std::vector<float> output = input;
+    conditioner c(OUT_RATE, params);
+    const double seconds = run_chunked(c, output);
+
+    printf("condition %-18s %7.1f us per second of audio (%6.0fx real time), speech %+.1f dB, pauses %+.1f dB",
+           name, seconds * 1e6 / BENCH_SECONDS, BENCH_SECONDS / seconds,
+           level_db(output, true) - level_db(input, true),
+           level_db(output, false) - level_db(input, false));
+    if (params.highpass_hz > 0.0f) {
+        printf(", 50 Hz %+.1f dB, 300 Hz %+.1f dB", tone_gain_db(params.highpass_hz, 50.0), tone_gain_db(params.highpass_hz, 300.0));
+    }
+    printf("\n");
+}
+
+int main() {
+    for (int rate : { 48000, 44100, 32000, 22050 }) {
+        bench_resampler(rate);
+    }
+
+    conditioner_params highpass;
+    highpass.highpass_hz = 80.0f;
+    conditioner_params gate;
+    gate.noise_gate = true;
+    conditioner_params agc;
+    agc.agc = true;
+    conditioner_params all = highpass;
+    all.noise_gate = true;
+    all.agc = true;
+
+    bench_conditioner("high-pass 80 Hz:", highpass);
+    bench_conditioner("noise gate:", gate);
+    bench_conditioner("AGC:", agc);
+    bench_conditioner("all three:", all);
+    return 0;
+}
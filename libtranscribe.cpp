@@ -0,0 +1,308 @@
+#include "libtranscribe.h"
+#include "transcribe-pipeline.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// An event waiting to be polled
+struct session_event {
+    int type = TRANSCRIBE_EVENT_NONE;
+    std::string text;
+    double audio_ms = 0.0;
+    double decode_ms = 0.0;
+    float avg_logprob = 0.0f;
+    float no_speech_prob = 0.0f;
+};
+
+// One stream, fed by push_audio or captured from a device, with its segmenter
+// thread, and an inference thread that turns its segments into events
+struct transcribe_session {
+    whisper_params params;
+    whisper_models models;
+    std::vector<transcribe_stream> streams;  // just the one
+    segment_queue queue;
+    inference_control control;
+    transcribe_stats stats;
+    std::unique_ptr<live_settings> live;
+    std::atomic<bool> stop{false};
+    std::thread inference;
+
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::deque<session_event> events;
+    bool ended = false;  // the inference thread is done
+    std::string text;    // of the event poll returned last
+};
+
+// whisper logs a lot at load time; an embedding application wants errors only
+static void whisper_log_errors(ggml_log_level level, const char * text, void * user_data) {
+    (void) user_data;
+    if (level >= GGML_LOG_LEVEL_ERROR) {
+        fputs(text, stderr);
+    }
+}
+
+transcribe_session_params transcribe_session_default_params(void) {
+    // the defaults are those of the transcribe binary
+    static const whisper_params defaults;
+
+    transcribe_session_params params;
+    params.model             = defaults.model.c_str();
+    params.fast_model        = nullptr;
+    params.vad_model         = defaults.vad_model.c_str();
+    params.language          = defaults.language.c_str();
+    params.backend           = "push";
+    params.device            = nullptr;
+    params.channel           = -1;
+    params.period_ms         = defaults.period_ms;
+    params.sample_rate       = WHISPER_SAMPLE_RATE;
+    params.highpass_hz       = defaults.highpass_hz;
+    params.noise_gate        = defaults.noise_gate;
+    params.agc               = defaults.agc;
+    params.n_threads         = defaults.n_threads;
+    params.beam_size         = defaults.beam_size;
+    params.vad_thold         = defaults.vad_thold;
+    params.silence_ms        = defaults.silence_ms;
+    params.latency_target_ms = defaults.latency_target_ms;
+    params.audio_buffer_ms   = defaults.audio_buffer_ms;
+    params.use_gpu           = defaults.use_gpu;
+    params.flash_attn        = defaults.flash_attn;
+    params.warmup            = defaults.warmup;
+    params.verbose           = defaults.verbose;
+    return params;
+}
+
+static void run_session_inference(transcribe_session * session) {
+    const transcript_sink add_event = [session](const pending_segment & segment, const transcript & result) {
+        session_event event;
+        event.type = TRANSCRIBE_EVENT_TEXT;
+        event.text = result.text;
+        event.audio_ms = segment.samples.size() * 1000.0 / WHISPER_SAMPLE_RATE;
+        event.decode_ms = result.decode_ms;
+        event.avg_logprob = result.avg_logprob;
+        event.no_speech_prob = result.no_speech_prob;
+        std::lock_guard<std::mutex> lock(session->mutex);
+        session->events.push_back(std::move(event));
+        session->cond.notify_all();
+    };
+    run_inference(session->models, session->queue, session->params, *session->live,
+                  session->control, session->stats, add_event);
+
+    std::lock_guard<std::mutex> lock(session->mutex);
+    session->ended = true;
+    session->cond.notify_all();
+}
+
+transcribe_session * transcribe_session_create(const transcribe_session_params * sparams) {
+    static std::once_flag initialized;
+    std::call_once(initialized, []() {
+        whisper_log_set(whisper_log_errors, nullptr);
+        ggml_backend_load_all();
+    });
+
+    std::unique_ptr<transcribe_session> session(new transcribe_session());
+    whisper_params & params = session->params;
+    if (sparams->model) {
+        params.model = sparams->model;
+    }
+    if (sparams->fast_model) {
+        params.fast_model = sparams->fast_model;
+    }
+    if (sparams->vad_model) {
+        params.vad_model = sparams->vad_model;
+    }
+    if (sparams->language) {
+        params.language = sparams->language;
+    }
+    if (sparams->backend) {
+        params.backend = sparams->backend;
+    }
+    if (sparams->device) {
+        params.device = sparams->device;
+    }
+    params.capture_rate      = sparams->sample_rate;
+    params.period_ms         = sparams->period_ms;
+    params.highpass_hz       = sparams->highpass_hz;
+    params.noise_gate        = sparams->noise_gate != 0;
+    params.agc               = sparams->agc != 0;
+    params.n_threads         = std::max(sparams->n_threads, 1);
+    params.beam_size         = sparams->beam_size;
+    params.vad_thold         = sparams->vad_thold;
+    params.silence_ms        = sparams->silence_ms;
+    params.latency_target_ms = sparams->latency_target_ms;
+    params.audio_buffer_ms   = sparams->audio_buffer_ms;
+    params.use_gpu           = sparams->use_gpu != 0;
+    params.flash_attn        = sparams->flash_attn != 0;
+    params.warmup            = sparams->warmup != 0;
+    params.verbose           = sparams->verbose != 0;
+    params.flush_on_stop     = true;  // finish() transcribes the speech in progress
+    if (!whisper_params_validate(params)) {
+        return nullptr;
+    }
+
+    whisper_models & models = session->models;
+    models.cparams = whisper_context_default_params();
+    models.cparams.use_gpu = params.use_gpu;
+    models.cparams.flash_attn = params.flash_attn;
+    models.paths.push_back(params.model);
+    if (!params.fast_model.empty()) {
+        models.paths.push_back(params.fast_model);
+    }
+    if (!load_models(models)) {
+        return nullptr;
+    }
+
+    session->streams.resize(1);
+    transcribe_stream & stream = session->streams[0];
+    parse_stream_spec(params.device, params, stream);
+    if (sparams->channel >= 0) {
+        stream.capture.channel = sparams->channel;
+    }
+    stream.capture.backend     = params.backend;
+    stream.capture.sample_rate = WHISPER_SAMPLE_RATE;
+    stream.capture.device_rate = params.capture_rate;
+    stream.capture.period_ms   = params.period_ms;
+    stream.capture.conditioning.highpass_hz = params.highpass_hz;
+    stream.capture.conditioning.noise_gate  = params.noise_gate;
+    stream.capture.conditioning.agc         = params.agc;
+
+    whisper_vad_context_params vad_cparams = whisper_vad_default_context_params();
+    vad_cparams.n_threads = params.n_threads;
+    vad_cparams.use_gpu = false;
+    stream.vad_ctx = whisper_vad_init_from_file_with_params(params.vad_model.c_str(), vad_cparams);
+    if (stream.vad_ctx == nullptr) {
+        fprintf(stderr, "%s: failed to initialize VAD context from %s\n", __func__, params.vad_model.c_str());
+        free_models(models, MEMORY_UNLOADED);
+        return nullptr;
+    }
+
+    if (params.warmup) {
+        session->stats.warmup_ms = warm_up(models, session->streams, params);
+    }
+
+    stream.audio.reset(new audio_capture(params.audio_buffer_ms));
+    if (!stream.audio->init(stream.capture) || !stream.audio->resume()) {
+        whisper_vad_free(stream.vad_ctx);
+        free_models(models, MEMORY_UNLOADED);
+        return nullptr;
+    }
+
+    session->live.reset(new live_settings(params));
+    session->queue.n_producers = 1;
+    stream.thread = std::thread(run_segmenter, std::ref(stream), 0, params, std::ref(*session->live),
+                                std::ref(session->queue), std::ref(session->stats), std::cref(session->stop));
+    session->inference = std::thread(run_session_inference, session.get());
+    return session.release();
+}
+
+void transcribe_session_free(transcribe_session * session) {
+    if (session == nullptr) {
+        return;
+    }
+
+    transcribe_stream & stream = session->streams[0];
+    session->stop = true;
+    stream.audio->interrupt();
+    session->queue.interrupt();
+    session->control.shut_down();
+    stream.thread.join();
+    session->inference.join();
+
+    if (session->params.verbose) {
+        session->stats.overruns = stream.audio->overruns();
+        session->stats.gaps = stream.audio->gaps();
+        enter_tier(session->stats, session->stats.tier);
+        print_stats(session->stats);
+    }
+
+    whisper_vad_free(stream.vad_ctx);
+    free_models(session->models, MEMORY_UNLOADED);
+    delete session;
+}
+
+size_t transcribe_session_push_audio(transcribe_session * session, const float * samples, size_t n_samples) {
+    if (session->params.backend != "push") {
+        return n_samples;
+    }
+
+    // In pieces of at most a quarter of the ring, each once the segmenter has
+    // read far enough to make room for it (plus a sample of resampler slack)
+    audio_capture & audio = *session->streams[0].audio;
+    const double ratio = audio.sample_rate() / (double) audio.device_rate();
+    const size_t n_piece = std::max<size_t>((size_t) audio.len_ms() * audio.device_rate() / 4000, 1);
+    for (size_t i = 0; i < n_samples; i += n_piece) {
+        const size_t n = std::min(n_piece, n_samples - i);
+        if (session->stop || !audio.wait_for_room((size_t) std::ceil(n * ratio) + 1)) {
+            return n_samples - i;
+        }
+        audio.write(samples + i, n);
+    }
+    return 0;
+}
+
+void transcribe_session_finish(transcribe_session * session) {
+    session->stop = true;
+    session->streams[0].audio->interrupt();
+}
+
+int transcribe_session_poll_event(transcribe_session * session, transcribe_event * event, int timeout_ms) {
+    std::unique_lock<std::mutex> lock(session->mutex);
+    const auto ready = [session]() { return !session->events.empty() || session->ended; };
+    if (timeout_ms < 0) {
+        session->cond.wait(lock, ready);
+    } else {
+        session->cond.wait_for(lock, std::chrono::milliseconds(timeout_ms), ready);
+    }
+
+    session_event next;
+    if (!session->events.empty()) {
+        next = std::move(session->events.front());
+        session->events.pop_front();
+    } else if (session->ended) {
+        next.type = TRANSCRIBE_EVENT_END;
+    }
+    session->text = std::move(next.text);
+
+    if (event) {
+        event->type = next.type;
+        event->text = next.type == TRANSCRIBE_EVENT_TEXT ? session->text.c_str() : nullptr;
+        event->audio_ms = next.audio_ms;
+        event->decode_ms = next.decode_ms;
+        event->avg_logprob = next.avg_logprob;
+        event->no_speech_prob = next.no_speech_prob;
+    }
+    return next.type;
+}
+
+void transcribe_session_get_stats(transcribe_session * session, transcribe_session_stats * stats) {
+    audio_capture & audio = *session->streams[0].audio;
+    const audio_capture::overrun_stats overruns = audio.overruns();
+    const audio_capture::gap_stats gaps = audio.gaps();
+    stats->n_overruns = overruns.n_overruns;
+    stats->overrun_lost_ms = overruns.n_lost * 1000.0 / WHISPER_SAMPLE_RATE;
+    stats->n_gaps = gaps.n_gaps;
+    stats->gap_ms = gaps.total_ms;
+
+    std::lock_guard<std::mutex> lock(session->stats.mutex);
+    stats->max_decode_ms = session->stats.max_inference_ms;
+}
+
+int transcribe_session_set_param(transcribe_session * session, const char * name, const char * value) {
+    if (name == nullptr || value == nullptr) {
+        return -1;
+    }
+    const std::string key = name;
+    if (key == "model" || key == "fast-model") {
+        return swap_model(session->models, key == "model" ? 0 : 1, value, session->params) ? 0 : -1;
+    }
+    return set_live_setting(*session->live, key, value) ? 0 : -1;
+}
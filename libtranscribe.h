@@ -0,0 +1,120 @@
+// libtranscribe: streaming speech transcription behind a C ABI
+//
+// The same pipeline as the transcribe binary (Silero VAD segmentation, then
+// whisper on each finished segment), for use in-process, e.g. from Python
+// through ctypes. The application pushes audio into a session and polls it
+// for events; a segmenter thread and an inference thread do the work in
+// between, so push and poll never wait for a decode. Alternatively the
+// session captures from a device itself (backend "sdl", "pulse" or "alsa"),
+// as the transcribe binary does, and the application only polls.
+//
+//   transcribe_session_params params = transcribe_session_default_params();
+//   params.model = "models/ggml-base.en.bin";
+//   transcribe_session * session = transcribe_session_create(&params);
+//   while (have audio) {
+//       transcribe_session_push_audio(session, samples, n_samples);
+//       while (transcribe_session_poll_event(session, &event, 0) == TRANSCRIBE_EVENT_TEXT) {
+//           use(event.text);
+//       }
+//   }
+//   transcribe_session_finish(session);
+//   while (transcribe_session_poll_event(session, &event, -1) != TRANSCRIBE_EVENT_END) { ... }
+//   transcribe_session_free(session);
+//
+// Booleans are ints so the structs map onto ctypes without surprises.
+
+#pragma once
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct transcribe_session transcribe_session;
+
+typedef struct transcribe_session_params {
+    const char * model;       // whisper model path
+    const char * fast_model;  // cheaper model for latency_target_ms; NULL for none
+    const char * vad_model;   // Silero VAD model path
+    const char * language;
+    const char * backend;     // "push": audio comes from push_audio; or capture from a device: "sdl", "pulse", "alsa"
+    const char * device;      // capture device name, or with sdl also an index; NULL = default
+    int channel;              // channel of a multichannel device to capture (-1 = open it as mono)
+    int period_ms;            // capture period (0 = backend default)
+    int sample_rate;          // rate of the pushed audio, or to open the device at; resampled to 16 kHz if different
+    float highpass_hz;        // high-pass captured or pushed audio at this many Hz (0 = off)
+    int noise_gate;           // attenuate audio near the noise floor
+    int agc;                  // automatic gain control
+    int n_threads;
+    int beam_size;            // 0 or 1 = greedy, 2+ = beam search
+    float vad_thold;          // VAD speech probability threshold
+    int silence_ms;           // silence that ends a segment
+    int latency_target_ms;    // 0 = off
+    int audio_buffer_ms;      // unread audio the ring holds; push_audio waits, a device overruns, beyond it
+    int use_gpu;
+    int flash_attn;
+    int warmup;               // run the models once before create returns
+    int verbose;              // [DEBUG] lines on stderr, like transcribe -v
+} transcribe_session_params;
+
+enum transcribe_event_type {
+    TRANSCRIBE_EVENT_NONE = 0,  // nothing happened before the timeout
+    TRANSCRIBE_EVENT_TEXT,      // a segment was transcribed
+    TRANSCRIBE_EVENT_END,       // after finish(), everything has been transcribed
+};
+
+typedef struct transcribe_session_stats {
+    unsigned long long n_overruns;  // times unread audio was overwritten: the segmenter fell behind a device
+    double overrun_lost_ms;         // audio lost that way
+    unsigned long long n_gaps;      // times the device was lost and reopened
+    double gap_ms;                  // time without audio over all gaps
+    double max_decode_ms;           // slowest decode
+} transcribe_session_stats;
+
+typedef struct transcribe_event {
+    int type;               // transcribe_event_type
+    const char * text;      // TEXT: valid until the next poll or free; NULL otherwise
+    double audio_ms;        // TEXT: length of the segment's audio
+    double decode_ms;       // TEXT: time whisper took
+    float avg_logprob;      // TEXT: mean log probability of the text tokens
+    float no_speech_prob;   // TEXT: whisper's estimate that there was no speech
+} transcribe_event;
+
+transcribe_session_params transcribe_session_default_params(void);
+
+// Load the models and start the session's threads; NULL on failure (the
+// reason goes to stderr)
+transcribe_session * transcribe_session_create(const transcribe_session_params * params);
+
+// Stop the threads, dropping any audio not yet transcribed, and free
+// everything. Text returned by poll is invalid afterwards.
+void transcribe_session_free(transcribe_session * session);
+
+// Append mono float samples at params.sample_rate, with the push backend.
+// Call from one thread at a time. It copies into the session's ring buffer,
+// blocking while the ring is full of audio the segmenter hasn't read yet, so
+// audio pushed faster than real time is never lost. Returns the number of
+// samples dropped: all of them after finish(), or with a device backend.
+size_t transcribe_session_push_audio(transcribe_session * session, const float * samples, size_t n_samples);
+
+// No more audio is coming: transcribe what is left of the current speech,
+// then poll returns TRANSCRIBE_EVENT_END
+void transcribe_session_finish(transcribe_session * session);
+
+// Wait up to timeout_ms (negative: no limit) for the next event and return
+// its type; TRANSCRIBE_EVENT_NONE if none came in time. event may be NULL.
+int transcribe_session_poll_event(transcribe_session * session, transcribe_event * event, int timeout_ms);
+
+// Overrun, gap and decode counters so far
+void transcribe_session_get_stats(transcribe_session * session, transcribe_session_stats * stats);
+
+// Change a setting while running: beam_size, n_threads, vad_thold or
+// silence_ms (from the next segment or step on), or model / fast-model (a
+// path; loads it before returning, then swaps it in between segments).
+// Returns 0 on success, -1 if name or value isn't valid.
+int transcribe_session_set_param(transcribe_session * session, const char * name, const char * value);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,189 @@
+"""ctypes bindings for libtranscribe (see libtranscribe.h)
+
+    with Session(model="models/ggml-base.en.bin") as session:
+        session.push_audio(samples)   # float32 mono at sample_rate: array, bytes or numpy
+        for text in session.texts():
+            print(text)
+        session.finish()
+        for text in session.texts(timeout_ms=-1):
+            print(text)
+
+Or let the session capture from a device itself:
+
+    with Session(backend="pulse", sample_rate=48000) as session:
+        for text in session.texts(timeout_ms=-1):
+            print(text)
+
+Build the library with `make lib`; it lands in build/libtranscribe.so.
+"""
+
+import ctypes
+import os
+from array import array
+from pathlib import Path
+from typing import Iterator, Optional
+
+EVENT_NONE = 0
+EVENT_TEXT = 1
+EVENT_END = 2
+
+
+class SessionParams(ctypes.Structure):
+    _fields_ = [
+        ("model", ctypes.c_char_p),
+        ("fast_model", ctypes.c_char_p),
+        ("vad_model", ctypes.c_char_p),
+        ("language", ctypes.c_char_p),
+        ("backend", ctypes.c_char_p),
+        ("device", ctypes.c_char_p),
+        ("channel", ctypes.c_int),
+        ("period_ms", ctypes.c_int),
+        ("sample_rate", ctypes.c_int),
+        ("highpass_hz", ctypes.c_float),
+        ("noise_gate", ctypes.c_int),
+        ("agc", ctypes.c_int),
+        ("n_threads", ctypes.c_int),
+        ("beam_size", ctypes.c_int),
+        ("vad_thold", ctypes.c_float),
+        ("silence_ms", ctypes.c_int),
+        ("latency_target_ms", ctypes.c_int),
+        ("audio_buffer_ms", ctypes.c_int),
+        ("use_gpu", ctypes.c_int),
+        ("flash_attn", ctypes.c_int),
+        ("warmup", ctypes.c_int),
+        ("verbose", ctypes.c_int),
+    ]
+
+
+class Stats(ctypes.Structure):
+    _fields_ = [
+        ("n_overruns", ctypes.c_ulonglong),
+        ("overrun_lost_ms", ctypes.c_double),
+        ("n_gaps", ctypes.c_ulonglong),
+        ("gap_ms", ctypes.c_double),
+        ("max_decode_ms", ctypes.c_double),
+    ]
+
+
+class Event(ctypes.Structure):
+    _fields_ = [
+        ("type", ctypes.c_int),
+        ("text", ctypes.c_char_p),
+        ("audio_ms", ctypes.c_double),
+        ("decode_ms", ctypes.c_double),
+        ("avg_logprob", ctypes.c_float),
+        ("no_speech_prob", ctypes.c_float),
+    ]
+
+
+_lib = None
+
+
+def load_library(path: Optional[str] = None) -> ctypes.CDLL:
+    """Load libtranscribe.so: path, $LIBTRANSCRIBE, or build/ next to this file"""
+    global _lib
+    if _lib is not None:
+        return _lib
+    if path is None:
+        path = os.environ.get("LIBTRANSCRIBE") or str(Path(__file__).parent / "build" / "libtranscribe.so")
+    lib = ctypes.CDLL(path)
+
+    lib.transcribe_session_default_params.restype = SessionParams
+    lib.transcribe_session_default_params.argtypes = []
+    lib.transcribe_session_create.restype = ctypes.c_void_p
+    lib.transcribe_session_create.argtypes = [ctypes.POINTER(SessionParams)]
+    lib.transcribe_session_free.restype = None
+    lib.transcribe_session_free.argtypes = [ctypes.c_void_p]
+    lib.transcribe_session_push_audio.restype = ctypes.c_size_t
+    lib.transcribe_session_push_audio.argtypes = [ctypes.c_void_p, ctypes.c_void_p, ctypes.c_size_t]
+    lib.transcribe_session_finish.restype = None
+    lib.transcribe_session_finish.argtypes = [ctypes.c_void_p]
+    lib.transcribe_session_get_stats.restype = None
+    lib.transcribe_session_get_stats.argtypes = [ctypes.c_void_p, ctypes.POINTER(Stats)]
+    lib.transcribe_session_poll_event.restype = ctypes.c_int
+    lib.transcribe_session_poll_event.argtypes = [ctypes.c_void_p, ctypes.POINTER(Event), ctypes.c_int]
+    lib.transcribe_session_set_param.restype = ctypes.c_int
+    lib.transcribe_session_set_param.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_char_p]
+
+    _lib = lib
+    return lib
+
+
+class Session:
+    """A streaming transcription session. Keyword arguments set the fields of
+    transcribe_session_params; the rest keep the transcribe binary's defaults.
+    After poll() returns text, event has its details (decode_ms, avg_logprob,
+    no_speech_prob)."""
+
+    def __init__(self, library: Optional[str] = None, **params):
+        self._session = None
+        self._lib = load_library(library)
+        self._params = self._lib.transcribe_session_default_params()
+        for name, value in params.items():
+            if isinstance(value, str):
+                value = value.encode()
+            setattr(self._params, name, value)
+        self._session = self._lib.transcribe_session_create(ctypes.byref(self._params))
+        if not self._session:
+            raise RuntimeError("failed to create transcription session (see stderr)")
+        self.event = Event()
+
+    def push_audio(self, samples) -> int:
+        """Append float32 mono samples (array('f'), bytes, or a numpy array),
+        waiting while the ring is full of unread audio. Returns the number of
+        samples dropped: all of them after finish(), or with a device backend."""
+        buffer = memoryview(samples).cast("B")
+        if buffer.readonly:
+            buffer = memoryview(bytearray(buffer))
+        data = (ctypes.c_char * buffer.nbytes).from_buffer(buffer)
+        return self._lib.transcribe_session_push_audio(self._session, data, buffer.nbytes // array("f").itemsize)
+
+    def finish(self) -> None:
+        """No more audio; texts(timeout_ms=-1) then runs until everything is transcribed"""
+        self._lib.transcribe_session_finish(self._session)
+
+    def poll(self, timeout_ms: int = 0) -> Optional[str]:
+        """Next transcribed text, or None if none came within timeout_ms. Raises
+        EOFError after finish() once everything has been transcribed."""
+        event_type = self._lib.transcribe_session_poll_event(self._session, ctypes.byref(self.event), timeout_ms)
+        if event_type == EVENT_TEXT:
+            return self.event.text.decode("utf-8", errors="replace")
+        if event_type == EVENT_END:
+            raise EOFError
+        return None
+
+    def texts(self, timeout_ms: int = 0) -> Iterator[str]:
+        """Transcribed texts until one doesn't come within timeout_ms, or the end"""
+        while True:
+            try:
+                text = self.poll(timeout_ms)
+            except EOFError:
+                return
+            if text is None:
+                return
+            yield text
+
+    def stats(self) -> Stats:
+        """Overrun, gap and decode counters so far"""
+        stats = Stats()
+        self._lib.transcribe_session_get_stats(self._session, ctypes.byref(stats))
+        return stats
+
+    def set_param(self, name: str, value) -> None:
+        """beam_size, n_threads, vad_thold, silence_ms, model or fast-model"""
+        if self._lib.transcribe_session_set_param(self._session, name.encode(), str(value).encode()) != 0:
+            raise ValueError(f"can't set {name} to {value}")
+
+    def close(self) -> None:
+        if self._session:
+            self._lib.transcribe_session_free(self._session)
+            self._session = None
+
+    def __enter__(self) -> "Session":
+        return self
+
+    def __exit__(self, *exc) -> None:
+        self.close()
+
+    def __del__(self) -> None:
+        self.close()
@@ -0,0 +1,1549 @@
+#include "transcribe-pipeline.h"
+#include "common.h"
+
+#include <sys/mman.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+#include <sys/resource.h>
+
+#include <cerrno>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+
+// Ambient audio measured per calibration when only --recalibrate is given
+static const int DEFAULT_CALIBRATE_S = 5;
+
+// Audio collected per step in the slowest tier
+static int longest_step_ms(const whisper_params & params) {
+    return params.idle_after_s > 0 ? params.idle_step_ms : params.min_step_ms;
+}
+
+bool whisper_params_validate(whisper_params & params) {
+    params.silence_ms = std::max(params.silence_ms, 500);
+    params.min_step_ms = std::max(params.min_step_ms, 32);  // one VAD window
+    params.pre_roll_ms = std::max(params.pre_roll_ms, 0);
+    params.period_ms = std::max(params.period_ms, 0);
+    params.capture_rate = std::max(params.capture_rate, 0);
+    params.highpass_hz = std::max(params.highpass_hz, 0.0f);
+    params.idle_after_s = std::max(params.idle_after_s, 0);
+    params.idle_step_ms = std::max(params.idle_step_ms, params.min_step_ms);
+    // The capture ring must hold a full step plus the VAD window and pre-roll
+    params.audio_buffer_ms = std::max({ params.audio_buffer_ms, 1000, longest_step_ms(params) + params.silence_ms + params.pre_roll_ms });
+    params.max_gap_ms = std::max(params.max_gap_ms, 0);
+    params.max_decode_ms = std::max(params.max_decode_ms, 0);
+    params.repeat_limit = std::max(params.repeat_limit, 0);
+    params.max_tps = std::max(params.max_tps, 0.0f);
+    params.max_tokens = std::max(params.max_tokens, 1);
+    params.max_wps = std::max(params.max_wps, 0.0f);
+    params.latency_target_ms = std::max(params.latency_target_ms, 0);
+    params.calibrate_s = std::max(params.calibrate_s, 0);
+    params.recalibrate_min = std::max(params.recalibrate_min, 0);
+    params.release_after_s = std::max(params.release_after_s, 0);
+    params.unload_after_min = std::max(params.unload_after_min, 0);
+    params.output_queue = std::max(params.output_queue, 1);
+    // Plain text has no way to take back an interim hypothesis
+    params.interim_ms = params.output == "text" ? 0 : std::max(params.interim_ms, 0);
+    if (params.interim_ms > 0) {
+        params.interim_ms = std::max(params.interim_ms, params.min_step_ms);
+    }
+    if (params.recalibrate_min > 0 && params.calibrate_s == 0) {
+        params.calibrate_s = DEFAULT_CALIBRATE_S;
+    }
+    params.whisper_log_level = std::max(0, std::min(params.whisper_log_level, 5));
+
+    // The memory tiers count time in the idle tier, which --idle-after 0 turns off
+    if (params.idle_after_s == 0 && (params.release_after_s > 0 || params.unload_after_min > 0)) {
+        fprintf(stderr, "error: --release-after and --unload-after need the idle tier (--idle-after > 0)\n");
+        return false;
+    }
+
+    // Language validation
+    if (params.language != "auto" && whisper_lang_id(params.language.c_str()) == -1) {
+        fprintf(stderr, "error: unknown language '%s'\n", params.language.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+// Silero scores audio in windows of this many samples (32 ms at 16 kHz)
+static const int VAD_WINDOW_SAMPLES = 512;
+
+// Speech probability of each Silero window (see VAD_WINDOW_SAMPLES) in
+// audio_samples. Returns false if the VAD couldn't run.
+static bool compute_vad_probs(
+    whisper_vad_context* vad_ctx,
+    const std::vector<float>& audio_samples,
+    std::vector<float>& probs) {
+
+    probs.clear();
+    if (!vad_ctx || audio_samples.empty()) {
+        return false;
+    }
+
+    // Run VAD detection
+    bool vad_success = whisper_vad_detect_speech(vad_ctx, audio_samples.data(), audio_samples.size());
+    if (!vad_success) {
+        return false;
+    }
+
+    // Get speech probabilities from VAD context
+    int n_probs = whisper_vad_n_probs(vad_ctx);
+    float* vad_probs = whisper_vad_probs(vad_ctx);
+
+    if (n_probs <= 0 || vad_probs == nullptr) {
+        return false;
+    }
+
+    probs.assign(vad_probs, vad_probs + n_probs);
+    return true;
+}
+
+static const char * abort_reason_str(int reason) {
+    switch (reason) {
+        case ABORT_STOP:     return "stop requested";
+        case ABORT_DEADLINE: return "deadline exceeded";
+        case ABORT_RATE:     return "token rate";
+        case ABORT_SUPERSEDED: return "superseded";
+        default:             return "none";
+    }
+}
+
+static bool whisper_abort_callback(void * user_data) {
+    inference_control * control = (inference_control *) user_data;
+    if (control->shutting_down ||
+        (control->abort_on_stop && control->stop_requested && *control->stop_requested)) {
+        control->request(ABORT_STOP);
+    } else if (std::chrono::steady_clock::now() > control->deadline) {
+        control->request(ABORT_DEADLINE);
+    }
+    return control->reason != ABORT_NONE;
+}
+
+// Runaway decode detection. Whisper tends to loop ("you you you ...") on
+// silence or noise until max_tokens runs out; we watch the token sequence from
+// the logits filter callback, which runs once per decoder (beam). A looping
+// decoder is made to end its text there, leaving the others to go on; a
+// decoder over the token rate cancels the decode through the abort callback.
+struct decode_monitor {
+    whisper_token token_eot;
+    int repeat_limit;
+    int max_text_tokens;  // INT_MAX when the rate check is off
+    inference_control * control;
+};
+
+// Longest n-gram considered by the repetition check, and the fewest tokens the
+// repeats must cover, so short real ones ("no, no, no") aren't taken for loops
+static const int REPEAT_MAX_NGRAM = 8;
+static const int REPEAT_MIN_TOKENS = 16;
+
+// Number of times the trailing n-gram of length n repeats back to back
+static int count_tail_repeats(const std::vector<whisper_token> & tokens, int n) {
+    const int len = (int) tokens.size();
+    int repeats = 1;
+    for (int start = len - 2 * n; start >= 0; start -= n) {
+        if (!std::equal(tokens.begin() + start, tokens.begin() + start + n, tokens.end() - n)) {
+            break;
+        }
+        repeats++;
+    }
+    return repeats;
+}
+
+// If tokens end in an n-gram repeated back to back repeat_limit or more times,
+// over at least REPEAT_MIN_TOKENS, the number of tokens up to the end of its
+// first pass; otherwise -1
+static int find_tail_loop(const std::vector<whisper_token> & tokens, int repeat_limit) {
+    const int max_n = std::min(REPEAT_MAX_NGRAM, (int) tokens.size() / repeat_limit);
+    for (int n = 1; n <= max_n; ++n) {
+        const int repeats = count_tail_repeats(tokens, n);
+        if (repeats >= repeat_limit && repeats * n >= REPEAT_MIN_TOKENS) {
+            return (int) tokens.size() - (repeats - 1) * n;
+        }
+    }
+    return -1;
+}
+
+static void whisper_logits_filter_monitor(
+    whisper_context * ctx, whisper_state * state,
+    const whisper_token_data * tokens, int n_tokens,
+    float * logits, void * user_data) {
+    (void) state;
+    decode_monitor * monitor = (decode_monitor *) user_data;
+
+    // Only text tokens count; timestamps and other special tokens sort after EOT
+    std::vector<whisper_token> text_tokens;
+    text_tokens.reserve(n_tokens);
+    for (int i = 0; i < n_tokens; ++i) {
+        if (tokens[i].id < monitor->token_eot) {
+            text_tokens.push_back(tokens[i].id);
+        }
+    }
+
+    if ((int) text_tokens.size() > monitor->max_text_tokens) {
+        monitor->control->request(ABORT_RATE);
+        return;
+    }
+
+    // Only EOT is left for this decoder; its loop is cut off the text afterwards
+    if (monitor->repeat_limit > 0 && find_tail_loop(text_tokens, monitor->repeat_limit) >= 0) {
+        const int n_vocab = whisper_n_vocab(ctx);
+        for (int i = 0; i < n_vocab; ++i) {
+            if (i != monitor->token_eot) {
+                logits[i] = -INFINITY;
+            }
+        }
+    }
+}
+
+// Token budget for a segment: enough for someone talking at max_wps for the
+// whole segment, with room for punctuation, timestamp tokens and sub-word
+// splits, capped at max_tokens. Bounds the decode time of short segments that
+// go wrong, which are most of what we transcribe.
+static const float TOKENS_PER_WORD = 1.5f;
+static const int   TOKEN_BUDGET_BASE = 16;
+
+static int segment_token_budget(const whisper_params & params, size_t n_samples) {
+    if (params.max_wps <= 0.0f) {
+        return params.max_tokens;
+    }
+    const float segment_sec = n_samples / (float)WHISPER_SAMPLE_RATE;
+    const int budget = TOKEN_BUDGET_BASE + (int) std::ceil(segment_sec * params.max_wps * TOKENS_PER_WORD);
+    return std::min(budget, params.max_tokens);
+}
+
+// The encoder produces 50 frames per second of audio; audio_ctx is in frames
+static const int ENCODER_FRAMES_PER_SEC = 50;
+static const int AUDIO_CTX_MARGIN = 32;
+static const int AUDIO_CTX_BUCKETS[] = { 256, 512, 768, 1024, 1280 };
+
+// Smallest audio_ctx bucket that holds the whole segment, or 0 if none does
+static int audio_ctx_bucket(size_t n_samples) {
+    const int frames = (int) (n_samples * ENCODER_FRAMES_PER_SEC / WHISPER_SAMPLE_RATE) + AUDIO_CTX_MARGIN;
+    for (int bucket : AUDIO_CTX_BUCKETS) {
+        if (frames <= bucket) {
+            return bucket;
+        }
+    }
+    return 0;
+}
+
+// Re-measure a config that was rejected as too slow after this many decodes,
+// so we move back to better settings once CPU contention goes away
+static const int LATENCY_REPROBE_DECODES = 50;
+
+static decode_config plan_decode(
+    decode_planner & planner,
+    const whisper_params & params,
+    int n_models,
+    size_t n_samples,
+    double & predicted_ms) {
+
+    predicted_ms = -1.0;
+    decode_config fixed = { 0, params.beam_size, params.audio_ctx };
+    if (params.latency_target_ms <= 0) {
+        return fixed;
+    }
+
+    // The endpoint detector has already spent silence_ms of the target
+    const double budget_ms = params.latency_target_ms - params.silence_ms;
+    const double segment_sec = n_samples / (double)WHISPER_SAMPLE_RATE;
+
+    std::vector<int> beam_sizes = { params.beam_size };
+    if (params.beam_size > 1) {
+        beam_sizes.push_back(1);
+    }
+    std::vector<int> audio_ctxs = { params.audio_ctx };
+    if (params.audio_ctx == 0 && audio_ctx_bucket(n_samples) > 0) {
+        audio_ctxs.push_back(audio_ctx_bucket(n_samples));
+    }
+
+    decode_config fastest = fixed;
+    double fastest_ms = -1.0;
+    for (int model = 0; model < n_models; ++model) {
+        for (int beam_size : beam_sizes) {
+            for (int audio_ctx : audio_ctxs) {
+                decode_config config = { model, beam_size, audio_ctx };
+                auto it = planner.models.find(std::make_tuple(model, beam_size, audio_ctx));
+                if (it == planner.models.end() ||
+                    planner.n_decodes - it->second.last_decode > LATENCY_REPROBE_DECODES) {
+                    return config;
+                }
+                const double ms = it->second.predict(segment_sec);
+                if (ms <= budget_ms) {
+                    predicted_ms = ms;
+                    return config;
+                }
+                if (fastest_ms < 0.0 || ms < fastest_ms) {
+                    fastest = config;
+                    fastest_ms = ms;
+                }
+            }
+        }
+    }
+
+    predicted_ms = fastest_ms;
+    return fastest;
+}
+
+static void record_decode(
+    decode_planner & planner,
+    const decode_config & config,
+    size_t n_samples,
+    double inference_ms) {
+
+    latency_model & model = planner.models[std::make_tuple(config.model, config.beam_size, config.audio_ctx)];
+    model.add(n_samples / (double)WHISPER_SAMPLE_RATE, inference_ms);
+    model.last_decode = ++planner.n_decodes;
+}
+
+// Shorten pauses inside a segment before inference. Runs of VAD windows below
+// the threshold that are longer than max_gap_samples keep max_gap_samples of
+// audio, split between the two sides of the pause so word onsets and tails
+// survive. Leading and trailing silence are left alone. Returns the number of
+// samples removed.
+static size_t excise_silence(
+    whisper_vad_context* vad_ctx,
+    std::vector<float>& pcmf32_segment,
+    float vad_threshold,
+    int max_gap_samples) {
+
+    if (max_gap_samples <= 0 || !whisper_vad_detect_speech(vad_ctx, pcmf32_segment.data(), pcmf32_segment.size())) {
+        return 0;
+    }
+
+    const int n_probs = whisper_vad_n_probs(vad_ctx);
+    const float * probs = whisper_vad_probs(vad_ctx);
+    const size_t n_samples = pcmf32_segment.size();
+
+    std::vector<float> out;
+    out.reserve(n_samples);
+    size_t copied = 0;  // input samples before this index have been handled
+
+    int i = 0;
+    while (i < n_probs && probs[i] <= vad_threshold) {
+        i++;  // leading silence
+    }
+    while (i < n_probs) {
+        if (probs[i] > vad_threshold) {
+            i++;
+            continue;
+        }
+        int run_end = i;
+        while (run_end < n_probs && probs[run_end] <= vad_threshold) {
+            run_end++;
+        }
+        if (run_end == n_probs) {
+            break;  // trailing silence
+        }
+
+        const size_t gap_start = (size_t) i * VAD_WINDOW_SAMPLES;
+        const size_t gap_end = std::min((size_t) run_end * VAD_WINDOW_SAMPLES, n_samples);
+        if (gap_end - gap_start > (size_t) max_gap_samples) {
+            const size_t keep_head = max_gap_samples / 2;
+            const size_t keep_tail = max_gap_samples - keep_head;
+            out.insert(out.end(), pcmf32_segment.begin() + copied, pcmf32_segment.begin() + gap_start + keep_head);
+            copied = gap_end - keep_tail;
+        }
+        i = run_end;
+    }
+    out.insert(out.end(), pcmf32_segment.begin() + copied, pcmf32_segment.end());
+
+    const size_t removed = n_samples - out.size();
+    pcmf32_segment.swap(out);
+    return removed;
+}
+
+// Decode a segment into result; its text stays empty if the decode failed
+// or was aborted
+static void transcribe_audio_segment(
+    whisper_context* ctx,
+    whisper_state* state,
+    const std::vector<float>& pcmf32_segment,
+    const whisper_params& params,
+    const decode_config& config,
+    inference_control& control,
+    transcript& result) {
+    
+    if (pcmf32_segment.empty()) {
+        return;
+    }
+    
+    if (params.verbose) {
+        fprintf(stderr, "[DEBUG] Running whisper inference on %.1f seconds of audio (max %d tokens, model %d, beam %d, audio_ctx %d)\n",
+                pcmf32_segment.size() / (float)WHISPER_SAMPLE_RATE,
+                segment_token_budget(params, pcmf32_segment.size()),
+                config.model, config.beam_size, config.audio_ctx);
+    }
+
+    auto t_start = std::chrono::high_resolution_clock::now();
+    control.reset(!params.flush_on_stop, params.max_decode_ms);
+
+    // Run whisper inference
+    // Choose strategy based on beam_size parameter
+    whisper_sampling_strategy strategy = (config.beam_size <= 1) ? WHISPER_SAMPLING_GREEDY : WHISPER_SAMPLING_BEAM_SEARCH;
+    whisper_full_params wparams = whisper_full_default_params(strategy);
+    wparams.print_progress   = false;
+    wparams.print_special    = false;  // Always hide special tokens
+    wparams.print_realtime   = false;
+    wparams.print_timestamps = false;
+    wparams.suppress_nst     = true;   // Suppress non-speech tokens
+    wparams.translate        = false;  // Always transcribe in original language
+    wparams.single_segment   = false;
+    wparams.max_tokens       = segment_token_budget(params, pcmf32_segment.size());
+    wparams.language         = params.language.c_str();
+    wparams.n_threads        = params.n_threads;
+    wparams.audio_ctx        = config.audio_ctx;
+    wparams.temperature_inc  = params.no_fallback ? 0.0f : wparams.temperature_inc;
+
+    // Set beam size for beam search strategy
+    if (strategy == WHISPER_SAMPLING_BEAM_SEARCH) {
+        wparams.beam_search.beam_size = config.beam_size;
+    }
+
+    wparams.abort_callback           = whisper_abort_callback;
+    wparams.abort_callback_user_data = &control;
+
+    // A few tokens of slack so very short segments aren't cut off. The filter
+    // only sees the tokens of the current 30 s window, so longer segments get
+    // one window's budget, not one for their whole length.
+    const float window_sec = std::min(pcmf32_segment.size() / (float)WHISPER_SAMPLE_RATE, (float) WHISPER_CHUNK_SIZE);
+    decode_monitor monitor;
+    monitor.token_eot       = whisper_token_eot(ctx);
+    monitor.repeat_limit    = params.repeat_limit;
+    monitor.max_text_tokens = params.max_tps > 0.0f ? 8 + (int) (params.max_tps * window_sec) : INT_MAX;
+    monitor.control         = &control;
+    wparams.logits_filter_callback           = whisper_logits_filter_monitor;
+    wparams.logits_filter_callback_user_data = &monitor;
+
+    int ret = whisper_full_with_state(ctx, state, wparams, pcmf32_segment.data(), pcmf32_segment.size());
+    if (control.reason != ABORT_NONE) {
+        if (params.verbose) {
+            auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::high_resolution_clock::now() - t_start).count();
+            fprintf(stderr, "[DEBUG] Inference aborted after %ld ms: %s\n", elapsed, abort_reason_str(control.reason));
+        }
+        return;
+    }
+
+    if (ret == 0) {
+        auto t_end = std::chrono::high_resolution_clock::now();
+        auto inference_time = std::chrono::duration_cast<std::chrono::milliseconds>(t_end - t_start).count();
+
+        if (params.verbose) {
+            float audio_duration = pcmf32_segment.size() / (float)WHISPER_SAMPLE_RATE * 1000.0f; // ms
+            float real_time_factor = audio_duration / inference_time;
+            fprintf(stderr, "[DEBUG] Inference completed in %ld ms (%.1fx real-time, flash_attn=%s)\n",
+                    inference_time, real_time_factor, params.flash_attn ? "on" : "off");
+        }
+
+        // Extract and output text segments, with the mean log probability of
+        // their text tokens and whisper's estimate that there was no speech
+        const int n_segments = whisper_full_n_segments_from_state(state);
+        const whisper_token token_eot = whisper_token_eot(ctx);
+        std::string full_text;
+        std::vector<whisper_token> text_tokens;
+        std::vector<float> logprobs;
+
+        for (int i = 0; i < n_segments; ++i) {
+            const char * text = whisper_full_get_segment_text_from_state(state, i);
+            if (text && strlen(text) > 0) {
+                full_text += text;
+            }
+            result.no_speech_prob = std::max(result.no_speech_prob, whisper_full_get_segment_no_speech_prob_from_state(state, i));
+            const int n_tokens = whisper_full_n_tokens_from_state(state, i);
+            for (int j = 0; j < n_tokens; ++j) {
+                const whisper_token_data token = whisper_full_get_token_data_from_state(state, i, j);
+                if (token.id < token_eot) {
+                    text_tokens.push_back(token.id);
+                    logprobs.push_back(token.plog);
+                }
+            }
+        }
+
+        // If the decoder we got was stopped in a loop, keep the text up to
+        // the end of the loop's first pass, rebuilt from the tokens
+        const int n_keep = params.repeat_limit > 0 ? find_tail_loop(text_tokens, params.repeat_limit) : -1;
+        if (n_keep >= 0) {
+            if (params.verbose) {
+                fprintf(stderr, "[DEBUG] Decode looped; cut %d repeated tokens\n", (int) text_tokens.size() - n_keep);
+            }
+            full_text.clear();
+            for (int i = 0; i < n_keep; ++i) {
+                full_text += whisper_token_to_str(ctx, text_tokens[i]);
+            }
+            text_tokens.resize(n_keep);
+            logprobs.resize(n_keep);
+            result.loop_cut = true;
+        }
+
+        double sum_logprob = 0.0;
+        for (float logprob : logprobs) {
+            sum_logprob += logprob;
+        }
+        result.n_tokens = (int) text_tokens.size();
+        result.avg_logprob = result.n_tokens > 0 ? (float) (sum_logprob / result.n_tokens) : 0.0f;
+
+        // Clean up the text (remove leading/trailing whitespace)
+        result.text = ::trim(full_text);
+    }
+}
+
+static const char * power_tier_str(int tier) {
+    return tier == TIER_IDLE ? "idle" : "active";
+}
+
+uint64_t voluntary_context_switches() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_nvcsw;
+}
+
+static page_faults page_faults_now() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return { (uint64_t) usage.ru_majflt, (uint64_t) usage.ru_minflt };
+}
+
+long proc_status_kb(const char * field) {
+    std::ifstream file("/proc/self/status");
+    const std::string prefix = std::string(field) + ":";
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.compare(0, prefix.size(), prefix) == 0) {
+            return std::stol(line.substr(prefix.size()));
+        }
+    }
+    return -1;
+}
+
+bool lock_memory(const whisper_params & params) {
+    if (mlockall(MCL_CURRENT) != 0) {
+        fprintf(stderr, "%s: WARNING: mlockall failed: %s%s\n", __func__, strerror(errno),
+                errno == ENOMEM || errno == EPERM ? " (raise ulimit -l, or run with CAP_IPC_LOCK)" : "");
+        return false;
+    }
+    if (params.verbose) {
+        fprintf(stderr, "%s: locked %.0f MB in RAM\n", __func__, proc_status_kb("VmLck") / 1024.0);
+    }
+    return true;
+}
+
+void enter_tier(transcribe_stats & stats, int tier) {
+    const auto now = std::chrono::steady_clock::now();
+    const uint64_t nvcsw = voluntary_context_switches();
+    tier_usage & usage = stats.tiers[stats.tier];
+    usage.seconds += std::chrono::duration<double>(now - stats.tier_since).count();
+    usage.nvcsw += nvcsw - stats.tier_nvcsw_since;
+    stats.tier = tier;
+    stats.tier_since = now;
+    stats.tier_nvcsw_since = nvcsw;
+}
+
+void print_stats(const transcribe_stats & stats) {
+    fprintf(stderr, "\n%s: %d segments, %d produced text\n", __func__, stats.n_segments, stats.n_outputs);
+    if (stats.n_interim > 0) {
+        fprintf(stderr, "%s: %d interim decodes\n", __func__, stats.n_interim);
+    }
+    fprintf(stderr, "%s: %.1f s of audio transcribed, %.1f s of pauses excised\n", __func__,
+            stats.audio_ms / 1000.0, stats.excised_ms / 1000.0);
+    fprintf(stderr, "%s: slowest decode %.0f ms, %llu audio overruns lost %.1f s\n", __func__,
+            stats.max_inference_ms, (unsigned long long) stats.overruns.n_overruns,
+            stats.overruns.n_lost / (double)WHISPER_SAMPLE_RATE);
+    fprintf(stderr, "%s: segment queue: at most %zu waiting, longest wait %.0f ms\n", __func__,
+            stats.max_queue_depth, stats.max_queue_wait_ms);
+    if (stats.first_inference_ms >= 0.0) {
+        if (stats.warmup_ms >= 0.0) {
+            fprintf(stderr, "%s: first decode %.0f ms, after a %.0f ms warm-up\n", __func__,
+                    stats.first_inference_ms, stats.warmup_ms);
+        } else {
+            fprintf(stderr, "%s: first decode %.0f ms, without warm-up\n", __func__, stats.first_inference_ms);
+        }
+    }
+    if (stats.n_segments > 0) {
+        fprintf(stderr, "%s: page faults during decodes: %llu major (at most %llu in one), %llu minor\n", __func__,
+                (unsigned long long) stats.faults.major, (unsigned long long) stats.max_major_faults,
+                (unsigned long long) stats.faults.minor);
+    }
+    if (stats.gaps.n_gaps > 0) {
+        fprintf(stderr, "%s: capture device lost %llu times, %.1f s without audio\n", __func__,
+                (unsigned long long) stats.gaps.n_gaps, stats.gaps.total_ms / 1000.0);
+    }
+    for (int t = 0; t < TIER_COUNT; ++t) {
+        const tier_usage & usage = stats.tiers[t];
+        if (usage.seconds > 0.0) {
+            fprintf(stderr, "%s: %s for %.0f s: %.2f loop wakeups/s, %.2f thread wakeups/s\n", __func__,
+                    power_tier_str(t), usage.seconds,
+                    usage.loop_wakeups / usage.seconds, usage.nvcsw / usage.seconds);
+        }
+    }
+    for (int r = ABORT_NONE + 1; r < ABORT_COUNT; ++r) {
+        if (stats.n_aborted[r] > 0) {
+            fprintf(stderr, "%s: aborted (%s): %d\n", __func__, abort_reason_str(r), stats.n_aborted[r]);
+        }
+    }
+    if (stats.n_loops_cut > 0) {
+        fprintf(stderr, "%s: repetition loops cut short: %d\n", __func__, stats.n_loops_cut);
+    }
+}
+
+static const char * memory_tier_str(int tier) {
+    switch (tier) {
+        case MEMORY_RELEASED: return "compute buffers released";
+        case MEMORY_UNLOADED: return "models unloaded";
+        default:              return "loaded";
+    }
+}
+
+bool load_models(whisper_models & models) {
+    if (models.contexts.empty()) {
+        for (const std::string & path : models.paths) {
+            whisper_context * ctx = whisper_init_from_file_with_params_no_state(path.c_str(), models.cparams);
+            if (ctx == nullptr) {
+                fprintf(stderr, "error: failed to initialize whisper context from %s\n", path.c_str());
+                for (whisper_context * c : models.contexts) {
+                    whisper_free(c);
+                }
+                models.contexts.clear();
+                return false;
+            }
+            models.contexts.push_back(ctx);
+        }
+    }
+    if (models.states.empty()) {
+        for (whisper_context * ctx : models.contexts) {
+            whisper_state * state = whisper_init_state(ctx);
+            if (state == nullptr) {
+                fprintf(stderr, "error: failed to initialize whisper state\n");
+                for (whisper_state * st : models.states) {
+                    whisper_free_state(st);
+                }
+                models.states.clear();
+                return false;
+            }
+            models.states.push_back(state);
+        }
+    }
+    return true;
+}
+
+void free_models(whisper_models & models, int tier) {
+    if (tier >= MEMORY_RELEASED) {
+        for (whisper_state * state : models.states) {
+            whisper_free_state(state);
+        }
+        models.states.clear();
+    }
+    if (tier >= MEMORY_UNLOADED) {
+        for (whisper_context * ctx : models.contexts) {
+            whisper_free(ctx);
+        }
+        models.contexts.clear();
+    }
+#ifdef __GLIBC__
+    // hand freed heap pages back to the system so RSS reflects the tier
+    malloc_trim(0);
+#endif
+}
+
+void run_model_manager(whisper_models & models, const whisper_params & params) {
+    const double release_s = params.release_after_s;
+    const double unload_s = params.unload_after_min * 60.0;
+
+    std::unique_lock<std::mutex> lock(models.mutex);
+    while (!models.stop) {
+        if (models.active) {
+            if (models.tier == MEMORY_LOADED || models.failed) {
+                models.cond.wait(lock);
+                continue;
+            }
+
+            // Reload without the lock, so streams changing tier don't wait for it
+            const int from = models.tier;
+            models.changing = true;
+            lock.unlock();
+            const auto t_start = std::chrono::steady_clock::now();
+            const bool ok = load_models(models);
+            if (ok && params.mlock) {
+                lock_memory(params);
+            }
+            const double reload_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t_start).count();
+            const long rss_kb = proc_status_kb("VmRSS");
+            lock.lock();
+            models.changing = false;
+
+            if (ok) {
+                models.tier = MEMORY_LOADED;
+                models.rss_kb[MEMORY_LOADED] = rss_kb;
+                models.n_reloads++;
+                models.max_reload_ms = std::max(models.max_reload_ms, reload_ms);
+            } else {
+                models.failed = true;
+            }
+            if (params.verbose) {
+                fprintf(stderr, "[DEBUG] Reloaded whisper models (were %s) in %.0f ms%s, RSS %.0f MB\n",
+                        memory_tier_str(from), reload_ms, ok ? "" : " - FAILED", rss_kb / 1024.0);
+            }
+            models.cond.notify_all();
+            continue;
+        }
+
+        // Idle: step down once each threshold has passed
+        const double idle_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - models.idle_since).count();
+        int target = MEMORY_LOADED;
+        double next_s = -1.0;
+        if (release_s > 0) {
+            if (idle_s >= release_s) {
+                target = MEMORY_RELEASED;
+            } else {
+                next_s = release_s;
+            }
+        }
+        if (unload_s > 0) {
+            if (idle_s >= unload_s) {
+                target = MEMORY_UNLOADED;
+            } else if (next_s < 0.0 || unload_s < next_s) {
+                next_s = unload_s;
+            }
+        }
+
+        if (target > models.tier && !models.busy) {
+            // Once the tier is lowered the inference thread keeps off the
+            // models, so they can be freed without the lock
+            models.tier = target;
+            models.changing = true;
+            lock.unlock();
+            free_models(models, target);
+            const long rss_kb = proc_status_kb("VmRSS");
+            lock.lock();
+            models.changing = false;
+            models.cond.notify_all();
+            models.rss_kb[target] = rss_kb;
+            if (params.verbose) {
+                fprintf(stderr, "[DEBUG] Idle for %.0f s: %s, RSS %.0f MB\n", idle_s, memory_tier_str(target), rss_kb / 1024.0);
+            }
+        } else if (next_s > 0.0 && !models.busy) {
+            models.cond.wait_until(lock, models.idle_since + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(next_s)));
+        } else {
+            models.cond.wait(lock);
+        }
+    }
+}
+
+void set_models_active(whisper_models & models, bool active) {
+    std::lock_guard<std::mutex> lock(models.mutex);
+    models.active = active;
+    if (active) {
+        models.failed = false;  // try again
+    } else {
+        models.idle_since = std::chrono::steady_clock::now();
+    }
+    models.cond.notify_all();
+}
+
+// Wait until the models are loaded and mark them in use. Returns false if
+// they couldn't be reloaded.
+static bool acquire_models(whisper_models & models) {
+    std::unique_lock<std::mutex> lock(models.mutex);
+    if (models.tier != MEMORY_LOADED) {
+        const auto t_start = std::chrono::steady_clock::now();
+        models.active = true;
+        models.failed = false;
+        models.cond.notify_all();
+        models.cond.wait(lock, [&models]() { return models.tier == MEMORY_LOADED || models.failed; });
+        const double wait_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t_start).count();
+        models.max_wait_ms = std::max(models.max_wait_ms, wait_ms);
+        if (models.failed) {
+            return false;
+        }
+    }
+    models.busy = true;
+    return true;
+}
+
+static void release_models(whisper_models & models) {
+    std::lock_guard<std::mutex> lock(models.mutex);
+    models.busy = false;
+    models.cond.notify_all();
+}
+
+void print_memory_stats(const whisper_models & models) {
+    for (int t = 0; t < MEMORY_COUNT; ++t) {
+        if (models.rss_kb[t] >= 0) {
+            fprintf(stderr, "%s: RSS with whisper %s: %.0f MB\n", __func__, memory_tier_str(t), models.rss_kb[t] / 1024.0);
+        }
+    }
+    if (models.n_reloads > 0) {
+        fprintf(stderr, "%s: %d reloads, slowest %.0f ms; decodes waited for a reload at most %.0f ms\n", __func__,
+                models.n_reloads, models.max_reload_ms, models.max_wait_ms);
+    }
+}
+
+// Energy gate for the idle tier. It opens when some VAD window is louder than
+// the noise floor by IDLE_GATE_FACTOR (about +6 dB), and never for windows
+// quieter than IDLE_GATE_MIN_RMS.
+static const float IDLE_GATE_FACTOR = 2.0f;
+static const float IDLE_GATE_MIN_RMS = 1e-3f;
+static const float NOISE_FLOOR_ALPHA = 0.1f;  // EMA weight of each speech-free step
+
+// RMS of the loudest VAD window in samples
+static float max_window_rms(const std::vector<float> & samples) {
+    float max_rms = 0.0f;
+    for (size_t begin = 0; begin < samples.size(); begin += VAD_WINDOW_SAMPLES) {
+        const size_t end = std::min(begin + VAD_WINDOW_SAMPLES, samples.size());
+        float sum = 0.0f;
+        for (size_t i = begin; i < end; ++i) {
+            sum += samples[i] * samples[i];
+        }
+        max_rms = std::max(max_rms, std::sqrt(sum / (end - begin)));
+    }
+    return max_rms;
+}
+
+// Ambient calibration. For a few seconds we collect the Silero probability
+// and RMS of every VAD window, then put the onset threshold a margin above
+// what the room's own noise scores, within limits. Quiet rooms get a lower
+// threshold (soft speech is caught), noisy ones a higher one (the fan doesn't
+// start segments). The RMS seeds the idle tier's noise floor.
+//
+// Windows are collected whatever the current threshold makes of them, since
+// hum that scores above it is what calibration is for. Speech is told apart
+// by energy instead: windows well above the quiet part of the recording are
+// left out. Steady noise stays close to that level however Silero scores it.
+static const float CALIBRATION_PERCENTILE = 0.99f;  // of ambient window probabilities
+static const float CALIBRATION_MARGIN = 0.15f;
+static const float CALIBRATION_QUIET_PERCENTILE = 0.1f;  // of window RMS, the reference level
+static const float CALIBRATION_SPEECH_FACTOR = 4.0f;     // about +12 dB over it is taken for speech
+static const float CALIBRATED_THOLD_MIN = 0.2f;
+static const float CALIBRATED_THOLD_MAX = 0.9f;
+static const float CALIBRATION_RMS_PERCENTILE = 0.9f;  // comparable to the loudest window of a step
+static const size_t CALIBRATION_MIN_WINDOWS = 31;      // about a second of ambient audio
+
+struct vad_calibration {
+    bool active = false;
+    uint64_t end = 0;          // stop collecting at this sample position
+    uint64_t last_end = 0;     // when the previous calibration finished
+    std::vector<float> probs;  // per VAD window
+    std::vector<float> rms;
+};
+
+static void start_calibration(vad_calibration & cal, uint64_t pos, const whisper_params & params) {
+    cal.active = true;
+    cal.end = pos + (uint64_t) params.calibrate_s * WHISPER_SAMPLE_RATE;
+    cal.probs.clear();
+    cal.rms.clear();
+}
+
+// Record the last n_windows VAD windows of samples
+static void add_calibration_windows(
+    vad_calibration & cal,
+    const std::vector<float> & samples,
+    const std::vector<float> & probs,
+    size_t n_windows) {
+
+    n_windows = std::min(n_windows, probs.size());
+    for (size_t w = probs.size() - n_windows; w < probs.size(); ++w) {
+        const size_t begin = w * VAD_WINDOW_SAMPLES;
+        const size_t end = std::min(begin + VAD_WINDOW_SAMPLES, samples.size());
+        float sum = 0.0f;
+        for (size_t i = begin; i < end; ++i) {
+            sum += samples[i] * samples[i];
+        }
+        cal.probs.push_back(probs[w]);
+        cal.rms.push_back(end > begin ? std::sqrt(sum / (end - begin)) : 0.0f);
+    }
+}
+
+static float percentile(std::vector<float> & values, float p) {
+    const size_t k = std::min(values.size() - 1, (size_t) (p * values.size()));
+    std::nth_element(values.begin(), values.begin() + k, values.end());
+    return values[k];
+}
+
+float rms_dbfs(float rms) {
+    return 20.0f * std::log10(std::max(rms, 1e-6f));
+}
+
+// Set the stream's VAD threshold and noise floor from a finished calibration.
+// Too little speech-free audio (someone talked throughout) keeps the old values.
+static void finish_calibration(
+    vad_calibration & cal,
+    transcribe_stream & stream,
+    float & noise_floor_rms) {
+
+    cal.active = false;
+    cal.last_end = cal.end;
+
+    // Drop the windows loud enough to be speech
+    if (!cal.rms.empty()) {
+        std::vector<float> rms = cal.rms;
+        const float speech_rms = percentile(rms, CALIBRATION_QUIET_PERCENTILE) * CALIBRATION_SPEECH_FACTOR;
+        size_t n_kept = 0;
+        for (size_t w = 0; w < cal.rms.size(); ++w) {
+            if (cal.rms[w] <= speech_rms) {
+                cal.probs[n_kept] = cal.probs[w];
+                cal.rms[n_kept] = cal.rms[w];
+                n_kept++;
+            }
+        }
+        cal.probs.resize(n_kept);
+        cal.rms.resize(n_kept);
+    }
+
+    if (cal.probs.size() < CALIBRATION_MIN_WINDOWS) {
+        fprintf(stderr, "%s: %swarning: not enough quiet audio to calibrate, keeping VAD threshold %.2f\n",
+                __func__, stream.tag.c_str(), stream.vad_thold);
+        return;
+    }
+
+    const float ambient_prob = percentile(cal.probs, CALIBRATION_PERCENTILE);
+    stream.vad_thold = std::min(std::max(ambient_prob + CALIBRATION_MARGIN, CALIBRATED_THOLD_MIN), CALIBRATED_THOLD_MAX);
+    stream.ambient_rms = percentile(cal.rms, CALIBRATION_RMS_PERCENTILE);
+    noise_floor_rms = stream.ambient_rms;
+    stream.n_calibrations++;
+
+    fprintf(stderr, "%s: %sVAD threshold %.2f (ambient speech probability %.2f at p%.0f), ambient level %.1f dBFS, from %.1f s\n",
+            __func__, stream.tag.c_str(), stream.vad_thold, ambient_prob, CALIBRATION_PERCENTILE * 100.0f,
+            rms_dbfs(stream.ambient_rms), cal.probs.size() * VAD_WINDOW_SAMPLES / (float)WHISPER_SAMPLE_RATE);
+}
+
+void parse_stream_spec(const std::string & spec, const whisper_params & params, transcribe_stream & stream) {
+    std::string device = spec;
+    stream.label = spec;
+
+    const size_t eq = device.find('=');
+    if (eq != std::string::npos) {
+        stream.label = device.substr(0, eq);
+        device = device.substr(eq + 1);
+    }
+    const size_t at = device.rfind('@');
+    if (at != std::string::npos) {
+        stream.capture.channel = std::stoi(device.substr(at + 1));
+        device = device.substr(0, at);
+    }
+
+    const bool is_index = !device.empty() && device.find_first_not_of("0123456789") == std::string::npos;
+    if (params.backend == "sdl" && is_index) {
+        stream.capture.capture_id = std::stoi(device);
+        stream.capture.device.clear();
+    } else {
+        stream.capture.capture_id = -1;
+        stream.capture.device = device;
+    }
+}
+
+// Cut long pauses out of a finished segment (using the stream's own VAD, on
+// its thread) and queue it for inference. samples hold capture positions
+// [begin, end); leaves them empty.
+static void queue_segment(
+    transcribe_stream& stream,
+    int index,
+    std::vector<float>& samples,
+    uint64_t begin,
+    uint64_t end,
+    int n_interim,
+    const whisper_params& params,
+    segment_queue& queue) {
+
+    if (samples.empty()) {
+        return;
+    }
+
+    pending_segment segment;
+    segment.stream = index;
+    segment.begin = begin;
+    segment.end = end;
+    segment.n_interim = n_interim;
+    segment.endpoint_time = std::chrono::system_clock::now();
+    segment.endpoint = std::chrono::steady_clock::now();
+    const int max_gap_samples = (params.max_gap_ms * WHISPER_SAMPLE_RATE) / 1000;
+    segment.n_excised = excise_silence(stream.vad_ctx, samples, stream.vad_thold, max_gap_samples);
+    segment.excise_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - segment.endpoint).count();
+    if (params.verbose && segment.n_excised > 0) {
+        fprintf(stderr, "[DEBUG] %sExcised %.2f s of pauses from segment\n", stream.tag.c_str(), segment.n_excised / (float)WHISPER_SAMPLE_RATE);
+    }
+    segment.samples.swap(samples);
+    samples.clear();
+    queue.push(std::move(segment));
+}
+
+// Queue a copy of the segment so far for an interim decode. It skips pause
+// excision, which would run the VAD over the whole segment again each time.
+static void queue_interim(
+    int index,
+    const std::vector<float>& samples,
+    uint64_t begin,
+    uint64_t end,
+    segment_queue& queue) {
+
+    pending_segment segment;
+    segment.stream = index;
+    segment.begin = begin;
+    segment.end = end;
+    segment.endpoint_time = std::chrono::system_clock::now();
+    segment.endpoint = std::chrono::steady_clock::now();
+    segment.interim = true;
+    segment.samples = samples;
+    queue.push(std::move(segment));
+}
+
+void emit_segment(
+    whisper_models& models,
+    pending_segment& segment,
+    const whisper_params& params,
+    decode_planner& planner,
+    inference_control& control,
+    transcribe_stats& stats,
+    const transcript_sink& sink) {
+
+    std::vector<float>& pcmf32_segment = segment.samples;
+    if (pcmf32_segment.empty()) {
+        return;
+    }
+
+    if (!segment.interim) {
+        stats.excised_ms += segment.n_excised * 1000.0 / WHISPER_SAMPLE_RATE;
+        stats.audio_ms += pcmf32_segment.size() * 1000.0 / WHISPER_SAMPLE_RATE;
+    }
+
+    if (!acquire_models(models)) {
+        fprintf(stderr, "error: whisper models could not be reloaded, dropping a %.1f s segment\n",
+                pcmf32_segment.size() / (float)WHISPER_SAMPLE_RATE);
+        return;
+    }
+
+    // Timings of a model that has been swapped out say nothing about its replacement
+    if (planner.generation != models.generation) {
+        planner = decode_planner();
+        planner.generation = models.generation;
+    }
+    double predicted_ms;
+    decode_config config = plan_decode(planner, params, (int) models.paths.size(), pcmf32_segment.size(), predicted_ms);
+    if (params.verbose && predicted_ms >= 0.0) {
+        fprintf(stderr, "[DEBUG] Predicted inference time %.0f ms\n", predicted_ms);
+    }
+    const page_faults faults_start = page_faults_now();
+    auto t_start = std::chrono::steady_clock::now();
+    transcript result;
+    transcribe_audio_segment(
+        models.contexts[config.model], models.states[config.model], pcmf32_segment, params, config, control, result);
+    auto t_end = std::chrono::steady_clock::now();
+    release_models(models);
+    if (segment.interim) {
+        stats.n_interim++;
+    } else {
+        stats.n_segments++;
+    }
+    stats.n_aborted[control.reason]++;
+    if (result.loop_cut) {
+        stats.n_loops_cut++;
+    }
+
+    // Process-wide, so a few of these may come from the capture threads
+    const page_faults faults_end = page_faults_now();
+    const uint64_t n_major = faults_end.major - faults_start.major;
+    const uint64_t n_minor = faults_end.minor - faults_start.minor;
+    stats.faults.major += n_major;
+    stats.faults.minor += n_minor;
+    stats.max_major_faults = std::max(stats.max_major_faults, n_major);
+    if (params.verbose) {
+        fprintf(stderr, "[DEBUG] Page faults during decode: %llu major, %llu minor\n",
+                (unsigned long long) n_major, (unsigned long long) n_minor);
+    }
+
+    // Aborted decodes say nothing about how long a full one takes
+    if (control.reason == ABORT_NONE) {
+        const double inference_ms = std::chrono::duration<double, std::milli>(t_end - t_start).count();
+        record_decode(planner, config, pcmf32_segment.size(), inference_ms);
+        std::lock_guard<std::mutex> lock(stats.mutex);
+        stats.max_inference_ms = std::max(stats.max_inference_ms, inference_ms);
+        if (stats.first_inference_ms < 0.0) {
+            stats.first_inference_ms = inference_ms;
+        }
+    }
+
+    // A final segment without text still retracts its interims
+    if (!result.text.empty() || (!segment.interim && segment.n_interim > 0)) {
+        result.model = config.model;
+        result.queue_ms = std::chrono::duration<double, std::milli>(t_start - segment.endpoint).count();
+        result.decode_ms = std::chrono::duration<double, std::milli>(t_end - t_start).count();
+        sink(segment, result);
+    }
+    if (!result.text.empty() && !segment.interim) {
+        stats.n_outputs++;
+    }
+}
+
+// Longest audio buffer --grow-buffer will ask for
+static const int MAX_AUDIO_BUFFER_MS = 60000;
+
+// Log overruns since the last check, and with --grow-buffer lengthen the
+// capture ring so the slowest segmenter step so far (with 50% headroom) plus
+// a step, the VAD window and the pre-roll fit, rounded up to whole seconds.
+// Decodes don't count: the segmenter keeps reading the ring while they run,
+// and segments waiting for one show up in the queue stats instead.
+static void check_audio_buffer(transcribe_stream & stream, const whisper_params & params) {
+    audio_capture & audio = *stream.audio;
+    const audio_capture::overrun_stats overruns = audio.overruns();
+    const uint64_t n_new = overruns.n_overruns - stream.overruns.n_overruns;
+    const double lost_ms = (overruns.n_lost - stream.overruns.n_lost) * 1000.0 / WHISPER_SAMPLE_RATE;
+    if (n_new > 0) {
+        const std::time_t t = std::chrono::system_clock::to_time_t(overruns.last_time);
+        char when[32];
+        std::strftime(when, sizeof(when), "%H:%M:%S", std::localtime(&t));
+        fprintf(stderr, "%s: %swarning: audio overrun at %s, lost %.0f ms (samples %llu..%llu), buffer is %d ms\n",
+                __func__, stream.tag.c_str(), when, lost_ms,
+                (unsigned long long) overruns.last_pos,
+                (unsigned long long) (overruns.last_pos + overruns.last_n_lost),
+                audio.len_ms());
+    }
+    stream.overruns = overruns;
+
+    if (!params.grow_buffer) {
+        return;
+    }
+
+    const int current_ms = audio.len_ms();
+    int wanted_ms = (int) (stream.max_step_ms * 1.5) + longest_step_ms(params) + params.silence_ms + params.pre_roll_ms;
+    if (n_new > 0) {
+        wanted_ms = std::max(wanted_ms, current_ms + (int) (2 * lost_ms));
+    }
+    wanted_ms = std::min(((wanted_ms + 999) / 1000) * 1000, MAX_AUDIO_BUFFER_MS);
+    if (wanted_ms > current_ms) {
+        if (params.verbose) {
+            fprintf(stderr, "[DEBUG] %sGrowing audio buffer from %d ms to %d ms\n", stream.tag.c_str(), current_ms, wanted_ms);
+        }
+        audio.resize(wanted_ms);
+    }
+}
+
+// Move a stream between the active and idle tiers. The tier stats measure the
+// process as a whole, which is idle only while every stream is.
+static void set_stream_tier(transcribe_stats & stats, transcribe_stream & stream, int tier) {
+    std::lock_guard<std::mutex> lock(stats.mutex);
+    stats.n_idle_streams += (tier == TIER_IDLE) - (stream.tier == TIER_IDLE);
+    stream.tier = tier;
+    const int process_tier = stats.n_idle_streams == stats.n_streams ? TIER_IDLE : TIER_ACTIVE;
+    if (process_tier != stats.tier) {
+        enter_tier(stats, process_tier);
+        if (stats.on_tier_change) {
+            stats.on_tier_change(process_tier);
+        }
+    }
+}
+
+bool apply_live_settings(live_settings & live, int & version, whisper_params & params) {
+    if (live.version == version) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(live.mutex);
+    version = live.version;
+    params.beam_size  = live.beam_size;
+    params.n_threads  = live.n_threads;
+    params.vad_thold  = live.vad_thold;
+    params.silence_ms = live.silence_ms;
+    return true;
+}
+
+// Open the stream's VAD context again with params.n_threads, on its segmenter
+// thread, the only one using it; keeps the old one if that fails
+static void reopen_vad(transcribe_stream & stream, const whisper_params & params) {
+    whisper_vad_context_params vad_cparams = whisper_vad_default_context_params();
+    vad_cparams.n_threads = params.n_threads;
+    vad_cparams.use_gpu = false;
+    whisper_vad_context * vad_ctx = whisper_vad_init_from_file_with_params(params.vad_model.c_str(), vad_cparams);
+    if (vad_ctx == nullptr) {
+        fprintf(stderr, "%s: %sfailed to reopen the VAD with %d threads, keeping the old one\n", __func__,
+                stream.tag.c_str(), params.n_threads);
+        return;
+    }
+    whisper_vad_free(stream.vad_ctx);
+    stream.vad_ctx = vad_ctx;
+    if (params.verbose) {
+        fprintf(stderr, "[DEBUG] %sVAD reopened with %d threads\n", stream.tag.c_str(), params.n_threads);
+    }
+}
+
+void run_segmenter(
+    transcribe_stream& stream,
+    int index,
+    whisper_params params,
+    live_settings& live,
+    segment_queue& queue,
+    transcribe_stats& stats,
+    const std::atomic<bool>& stop) {
+
+    audio_capture & audio = *stream.audio;
+    stream.vad_thold = params.vad_thold;
+    int live_version = 0;
+
+    // Audio buffers. Positions are absolute sample counts since capture started.
+    std::vector<float> pcmf32_segment; // Audio for current speech segment
+    std::vector<float> pcmf32_new;     // Audio captured since the last step
+    std::vector<float> pcmf32_vad;     // Audio the VAD looks at this step
+    std::vector<float> vad_probs;      // Speech probability per VAD window of pcmf32_vad
+    int n_samples_vad = (params.silence_ms * WHISPER_SAMPLE_RATE) / 1000;
+    int n_windows_silence = (n_samples_vad + VAD_WINDOW_SAMPLES - 1) / VAD_WINDOW_SAMPLES;
+    const int n_samples_pre_roll = (params.pre_roll_ms * WHISPER_SAMPLE_RATE) / 1000;
+    const uint64_t n_samples_interim = ((uint64_t) params.interim_ms * WHISPER_SAMPLE_RATE) / 1000;
+    uint64_t vad_end = 0;      // end of the audio the VAD has seen
+    uint64_t segment_begin = 0;  // capture positions of the audio in pcmf32_segment
+    uint64_t segment_end = 0;
+    uint64_t interim_end = 0;    // segment_end at the last interim
+    int n_interim = 0;           // interims queued for this segment
+
+    const int n_samples_step = (params.min_step_ms * WHISPER_SAMPLE_RATE) / 1000;
+    const int n_samples_idle_step = (params.idle_step_ms * WHISPER_SAMPLE_RATE) / 1000;
+    const uint64_t n_samples_idle_after = (uint64_t) params.idle_after_s * WHISPER_SAMPLE_RATE;
+    uint64_t speech_end = 0;       // end of the latest step that contained speech
+    float noise_floor_rms = 0.0f;  // loudness of speech-free audio, for the idle energy gate
+
+    const uint64_t n_samples_recalibrate = (uint64_t) params.recalibrate_min * 60 * WHISPER_SAMPLE_RATE;
+    vad_calibration calibration;
+    if (params.calibrate_s > 0) {
+        start_calibration(calibration, 0, params);
+    }
+
+    bool in_speech = false;
+
+    while (!stop) {
+        // An explicit threshold from --control replaces a calibrated one
+        const float vad_thold = params.vad_thold;
+        const int n_threads = params.n_threads;
+        if (apply_live_settings(live, live_version, params)) {
+            if (params.vad_thold != vad_thold) {
+                stream.vad_thold = params.vad_thold;
+            }
+            if (params.n_threads != n_threads) {
+                reopen_vad(stream, params);
+            }
+            n_samples_vad = (params.silence_ms * WHISPER_SAMPLE_RATE) / 1000;
+            n_windows_silence = (n_samples_vad + VAD_WINDOW_SAMPLES - 1) / VAD_WINDOW_SAMPLES;
+            const int wanted_ms = longest_step_ms(params) + params.silence_ms + params.pre_roll_ms;
+            if (audio.len_ms() < wanted_ms) {
+                audio.resize(wanted_ms);
+            }
+        }
+
+        // Sleep until the capture callback has delivered a full step of new
+        // audio (and enough for the first VAD window); a stop request wakes us.
+        const bool idle = stream.tier == TIER_IDLE;
+        if (!audio.wait(std::max<uint64_t>(vad_end + (idle ? n_samples_idle_step : n_samples_step), n_samples_vad))) {
+            break;
+        }
+        const auto t_step = std::chrono::steady_clock::now();
+        {
+            std::lock_guard<std::mutex> lock(stats.mutex);
+            stats.tiers[stats.tier].loop_wakeups++;
+        }
+        const uint64_t end = audio.position();
+        const uint64_t n_new = end - vad_end;
+
+        // Run the VAD over everything captured since the last step (at least
+        // silence_ms of it), in whole VAD windows ending at the newest sample.
+        const uint64_t n_unseen = std::max<uint64_t>(n_new, n_samples_vad);
+        const uint64_t n_vad = ((n_unseen + VAD_WINDOW_SAMPLES - 1) / VAD_WINDOW_SAMPLES) * VAD_WINDOW_SAMPLES;
+        const uint64_t vad_begin = audio.get(end > n_vad ? end - n_vad : 0, end, pcmf32_vad);
+        vad_end = end;
+        audio.consume(end);
+        check_audio_buffer(stream, params);
+
+        // While in speech, look for silence_ms without speech. Otherwise any
+        // speech window starts a segment, reaching back to the first one.
+        // When idle, Silero only runs if the energy gate opens (or we're
+        // calibrating and need its scores for the ambient noise).
+        bool voice_detected = false;
+        int first_speech_window = -1;
+        const float rms = max_window_rms(pcmf32_vad);
+        const bool gate_open = !idle || calibration.active ||
+            rms > std::max(IDLE_GATE_MIN_RMS, noise_floor_rms * IDLE_GATE_FACTOR);
+        if (gate_open && pcmf32_vad.size() >= static_cast<size_t>(n_samples_vad) &&
+            compute_vad_probs(stream.vad_ctx, pcmf32_vad, vad_probs)) {
+            const int n_probs = (int) vad_probs.size();
+            for (int i = 0; i < n_probs; ++i) {
+                if (vad_probs[i] > stream.vad_thold) {
+                    first_speech_window = i;
+                    break;
+                }
+            }
+            if (in_speech) {
+                const int tail = std::max(0, n_probs - n_windows_silence);
+                voice_detected = *std::max_element(vad_probs.begin() + tail, vad_probs.end()) > stream.vad_thold;
+            } else {
+                voice_detected = first_speech_window >= 0;
+            }
+
+            // Only the windows new this step; finish_calibration() leaves out speech
+            if (calibration.active) {
+                add_calibration_windows(calibration, pcmf32_vad, vad_probs, (n_new + VAD_WINDOW_SAMPLES - 1) / VAD_WINDOW_SAMPLES);
+            }
+        }
+
+        if (calibration.active && end >= calibration.end) {
+            finish_calibration(calibration, stream, noise_floor_rms);
+        } else if (!calibration.active && n_samples_recalibrate > 0 && idle &&
+                   end - calibration.last_end >= n_samples_recalibrate) {
+            if (params.verbose) {
+                fprintf(stderr, "[DEBUG] %sRecalibrating VAD threshold\n", stream.tag.c_str());
+            }
+            start_calibration(calibration, end, params);
+        }
+
+        if (voice_detected) {
+            speech_end = end;
+        } else if (!in_speech) {
+            noise_floor_rms += NOISE_FLOOR_ALPHA * (rms - noise_floor_rms);
+        }
+
+        if (in_speech) {
+            // Accumulate audio to speech segment.
+            audio.get(segment_end, end, pcmf32_new);
+            pcmf32_segment.insert(pcmf32_segment.end(), pcmf32_new.begin(), pcmf32_new.end());
+            segment_end = end;
+        }
+
+        if (voice_detected && !in_speech) {
+            // Start of new speech segment
+            if (params.verbose) {
+                fprintf(stderr, "\n[DEBUG] %sSpeech started, beginning new segment\n", stream.tag.c_str());
+            }
+            in_speech = true;
+
+            // Start pre_roll_ms before the first speech window so we don't
+            // truncate the first word, as far back as the ring allows.
+            const uint64_t onset = vad_begin + (uint64_t) first_speech_window * VAD_WINDOW_SAMPLES;
+            segment_begin = audio.get(onset > (uint64_t) n_samples_pre_roll ? onset - n_samples_pre_roll : 0, end, pcmf32_segment);
+            segment_end = end;
+            interim_end = end;
+            n_interim = 0;
+        } else if (voice_detected && n_samples_interim > 0 && segment_end - interim_end >= n_samples_interim) {
+            // Still talking; decode what we have so far
+            queue_interim(index, pcmf32_segment, segment_begin, segment_end, queue);
+            interim_end = segment_end;
+            n_interim++;
+        }
+
+        if (!voice_detected && in_speech) {
+            // End of speech segment; hand it to the inference loop
+            if (params.verbose) {
+                fprintf(stderr, "[DEBUG] %sSpeech ended, transcribing segment\n", stream.tag.c_str());
+            }
+
+            queue_segment(stream, index, pcmf32_segment, segment_begin, segment_end, n_interim, params, queue);
+
+            // Reset for next speech segment
+            in_speech = false;
+        }
+
+        // Move between the active and idle tiers
+        const int tier = (n_samples_idle_after > 0 && !in_speech && end - speech_end >= n_samples_idle_after)
+            ? TIER_IDLE : TIER_ACTIVE;
+        if (tier != stream.tier) {
+            if (params.verbose) {
+                fprintf(stderr, "[DEBUG] %sEntering %s tier (noise floor RMS %.4f)\n", stream.tag.c_str(), power_tier_str(tier), noise_floor_rms);
+            }
+            set_stream_tier(stats, stream, tier);
+        }
+
+        const double step_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t_step).count();
+        stream.max_step_ms = std::max(stream.max_step_ms, step_ms);
+    }
+
+    audio.pause();
+
+    // Speech may have started in the audio the VAD hasn't seen yet; with the
+    // push backend that can be everything since the last push
+    const uint64_t stop_end = audio.position();
+    if (params.flush_on_stop && !in_speech && stop_end > vad_end) {
+        const uint64_t vad_begin = audio.get(vad_end, stop_end, pcmf32_vad);
+        if (compute_vad_probs(stream.vad_ctx, pcmf32_vad, vad_probs)) {
+            const int n_probs = (int) vad_probs.size();
+            for (int i = 0; i < n_probs; ++i) {
+                if (vad_probs[i] > stream.vad_thold) {
+                    const uint64_t onset = vad_begin + (uint64_t) i * VAD_WINDOW_SAMPLES;
+                    segment_begin = audio.get(onset > (uint64_t) n_samples_pre_roll ? onset - n_samples_pre_roll : 0, stop_end, pcmf32_segment);
+                    segment_end = stop_end;
+                    in_speech = true;
+                    break;
+                }
+            }
+        }
+    }
+
+    // Queue whatever was said before the stop request, if asked to
+    if (params.flush_on_stop && in_speech) {
+        if (params.verbose) {
+            fprintf(stderr, "[DEBUG] %sStop requested mid-speech, flushing segment\n", stream.tag.c_str());
+        }
+        audio.get(segment_end, stop_end, pcmf32_new);
+        pcmf32_segment.insert(pcmf32_segment.end(), pcmf32_new.begin(), pcmf32_new.end());
+        queue_segment(stream, index, pcmf32_segment, segment_begin, stop_end, n_interim, params, queue);
+    }
+
+    queue.producer_done();
+}
+
+void run_inference(
+    whisper_models& models,
+    segment_queue& queue,
+    whisper_params params,
+    live_settings& live,
+    inference_control& control,
+    transcribe_stats& stats,
+    const transcript_sink& sink) {
+
+    decode_planner planner;
+    int live_version = 0;
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.control = &control;
+    }
+    pending_segment segment;
+    size_t n_waiting = 0;
+    while (queue.pop(segment, &n_waiting)) {
+        // A decoder that can't keep up shows as segments piling up here
+        const double wait_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - segment.endpoint).count();
+        stats.max_queue_depth = std::max(stats.max_queue_depth, n_waiting + 1);
+        stats.max_queue_wait_ms = std::max(stats.max_queue_wait_ms, wait_ms);
+        if (params.verbose && n_waiting > 0) {
+            fprintf(stderr, "[DEBUG] %zu more segments waiting for inference; this one waited %.0f ms\n", n_waiting, wait_ms);
+        }
+
+        const int n_threads = params.n_threads;
+        if (apply_live_settings(live, live_version, params) && params.n_threads != n_threads) {
+            planner.models.clear();  // measured with the old thread count
+        }
+        emit_segment(models, segment, params, planner, control, stats, sink);
+        queue.decode_done();
+    }
+}
+
+// Length of the synthetic segment --warmup decodes, and its pitch
+static const int WARMUP_MS = 2000;
+static const float WARMUP_PITCH_HZ = 120.0f;
+
+double warm_up(
+    whisper_models& models,
+    std::vector<transcribe_stream>& streams,
+    const whisper_params& params) {
+
+    // A buzz with falling harmonics, loud enough to be taken for speech
+    std::vector<float> samples((size_t) WARMUP_MS * WHISPER_SAMPLE_RATE / 1000);
+    for (size_t i = 0; i < samples.size(); ++i) {
+        const float t = i / (float)WHISPER_SAMPLE_RATE;
+        float sample = 0.0f;
+        for (int h = 1; h <= 10; ++h) {
+            sample += std::sin(2.0f * (float) M_PI * WARMUP_PITCH_HZ * h * t) / h;
+        }
+        samples[i] = 0.05f * sample;
+    }
+
+    const auto t_start = std::chrono::steady_clock::now();
+    std::vector<float> probs;
+    for (transcribe_stream & stream : streams) {
+        compute_vad_probs(stream.vad_ctx, samples, probs);
+    }
+    const auto t_vad = std::chrono::steady_clock::now();
+
+    // Same settings as a segment without --latency-target; the text is dropped
+    inference_control control;
+    transcript result;
+    for (size_t i = 0; i < models.contexts.size(); ++i) {
+        const decode_config config = { (int) i, params.beam_size, params.audio_ctx };
+        transcribe_audio_segment(models.contexts[i], models.states[i], samples, params, config, control, result);
+    }
+    const auto t_end = std::chrono::steady_clock::now();
+
+    if (params.verbose) {
+        fprintf(stderr, "[DEBUG] Warm-up took %.0f ms (VAD %.0f ms, whisper %.0f ms)\n",
+                std::chrono::duration<double, std::milli>(t_end - t_start).count(),
+                std::chrono::duration<double, std::milli>(t_vad - t_start).count(),
+                std::chrono::duration<double, std::milli>(t_end - t_vad).count());
+    }
+    return std::chrono::duration<double, std::milli>(t_end - t_start).count();
+}
+
+bool swap_model(whisper_models & models, int index, const std::string & path, const whisper_params & params) {
+    const auto t_start = std::chrono::steady_clock::now();
+    whisper_context * ctx = whisper_init_from_file_with_params_no_state(path.c_str(), models.cparams);
+    whisper_state * state = ctx ? whisper_init_state(ctx) : nullptr;
+    if (state == nullptr) {
+        fprintf(stderr, "control: error: failed to load %s\n", path.c_str());
+        if (ctx) {
+            whisper_free(ctx);
+        }
+        return false;
+    }
+    if (params.mlock) {
+        lock_memory(params);
+    }
+    const double load_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t_start).count();
+
+    std::unique_lock<std::mutex> lock(models.mutex);
+    models.cond.wait(lock, [&models]() { return models.stop || (!models.busy && !models.changing); });
+    // Shutting down; the models are about to be freed
+    if (models.stop) {
+        whisper_free_state(state);
+        whisper_free(ctx);
+        return false;
+    }
+    const bool added = index >= (int) models.paths.size();
+    if (added) {
+        models.paths.push_back(path);
+    } else {
+        models.paths[index] = path;
+    }
+    if (models.tier == MEMORY_UNLOADED) {
+        whisper_free_state(state);
+        whisper_free(ctx);
+    } else {
+        if (models.tier == MEMORY_LOADED) {
+            if (added) {
+                models.states.push_back(state);
+            } else {
+                std::swap(models.states[index], state);
+                whisper_free_state(state);
+            }
+        } else {
+            whisper_free_state(state);
+        }
+        if (added) {
+            models.contexts.push_back(ctx);
+        } else {
+            std::swap(models.contexts[index], ctx);
+            whisper_free(ctx);
+        }
+    }
+    models.generation++;
+    fprintf(stderr, "control: %s = %s (loaded in %.0f ms)\n", index == 0 ? "model" : "fast-model", path.c_str(), load_ms);
+    return true;
+}
+
+bool set_live_setting(live_settings & live, const std::string & name, const std::string & value) {
+    std::lock_guard<std::mutex> lock(live.mutex);
+    try {
+        if (name == "beam_size") {
+            live.beam_size = std::max(std::stoi(value), 0);
+        } else if (name == "n_threads") {
+            live.n_threads = std::max(std::stoi(value), 1);
+        } else if (name == "vad_thold") {
+            live.vad_thold = std::min(std::max(std::stof(value), 0.0f), 1.0f);
+        } else if (name == "silence_ms") {
+            live.silence_ms = std::max(std::stoi(value), 500);
+        } else {
+            return false;
+        }
+    } catch (const std::exception &) {
+        return false;
+    }
+    live.version++;
+    fprintf(stderr, "control: beam_size = %d, n_threads = %d, vad_thold = %.2f, silence_ms = %d\n",
+            live.beam_size, live.n_threads, live.vad_thold, live.silence_ms);
+    return true;
+}
+
@@ -0,0 +1,511 @@
+// Speech transcription pipeline, shared by the transcribe binary and libtranscribe
+//
+// Each stream captures audio into its own audio_capture ring and runs a
+// segmenter thread, which finds speech with Silero VAD and queues every
+// finished segment. A single inference loop takes the segments off the queue,
+// decodes them with whisper one at a time and hands the text to a
+// transcript_sink. Around that sit per-segment decode settings
+// (decode_planner), runaway decode detection and cancellation
+// (inference_control), power and memory tiers for idle periods, and the
+// settings that can change while running (live_settings).
+//
+// Nothing here handles signals or writes to stdout; that is up to the caller.
+
+#pragma once
+
+#include "audio-capture.h"
+#include "whisper.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+// Command-line parameters, also used by libtranscribe sessions
+struct whisper_params {
+    int32_t n_threads  = std::min(4, (int32_t) std::thread::hardware_concurrency());
+    int32_t capture_id = -1;
+    int32_t period_ms  = 0;      // Capture period (0 = backend default)
+    int32_t capture_rate = 0;    // Device sample rate; we resample to 16 kHz (0 = device native)
+    int32_t max_tokens = 128;   // Upper bound on the per-segment token budget
+    int32_t audio_ctx  = 0;
+
+    int32_t audio_buffer_ms = 2000;  // Audio buffer duration - must cover a segmenter step, the VAD window and pre-roll
+    int32_t silence_ms = 500;    // Silence duration before outputting text
+    int32_t pre_roll_ms = 300;   // Audio kept from before the first speech VAD window
+    int32_t min_step_ms = 250;   // Audio collected per processing step
+    int32_t idle_after_s = 30;   // Drop to the low-power idle tier after this long without speech (0 = never)
+    int32_t idle_step_ms = 1000; // Audio collected per processing step in the idle tier
+    int32_t max_gap_ms = 0;      // Shorten pauses inside a segment to this before inference (0 = keep as is)
+    int32_t beam_size = 5;       // Beam search size (0 or 1 = greedy, 2+ = beam search)
+    int32_t max_decode_ms = 0;   // Abort inference that runs longer than this (0 = no limit)
+    int32_t repeat_limit = 5;    // End a decoder whose output repeats an n-gram this many times in a row, over 16+ tokens (0 = off)
+    float max_tps      = 12.0f;  // Abort when text tokens exceed this rate for the segment's duration (0 = off)
+    float max_wps      = 5.0f;   // Words per second ceiling used to size the token budget (0 = always max_tokens)
+    int32_t latency_target_ms = 0;  // End of speech to text target; picks decode settings per segment (0 = off)
+    int32_t calibrate_s = 0;     // Measure ambient noise for this long at startup to set the VAD threshold (0 = off)
+    int32_t recalibrate_min = 0; // Calibrate again after this many minutes, while idle (0 = never)
+    int32_t release_after_s = 0; // Free whisper compute buffers after this long in the idle tier (0 = never)
+    int32_t unload_after_min = 0; // Unload the whisper models after this long in the idle tier (0 = never)
+    int32_t output_queue = 8;    // Segments waiting for stdout; past that, finals are joined and interims dropped
+    int32_t interim_ms = 0;      // Decode the segment so far this often while speech goes on (0 = only when it ends)
+    float vad_thold    = 0.5f;   // VAD speech probability threshold
+    float highpass_hz  = 0.0f;   // High-pass cutoff applied to captured audio (0 = off)
+
+    bool no_fallback   = true;
+    bool use_gpu       = true;
+    bool flash_attn    = false;
+    bool verbose       = false;
+    bool list_devices  = false;
+    bool startup_timing = false; // Print how long each startup phase took
+    bool exit_when_ready = false; // Exit as soon as we're ready to listen, for benchmarking startup
+    bool warmup        = false;  // Run the VAD and whisper once on synthetic audio before listening
+    bool mlock         = false;  // Lock the loaded models in RAM so they are never paged out
+    bool control       = false;  // Read model swaps and parameter changes from stdin
+    bool grow_buffer   = false;  // Lengthen the audio buffer when slow segmenter steps (or an overrun) show it's too short
+    bool flush_on_stop = false;  // On SIGINT/SIGTERM, finish and output the current segment instead of discarding it
+    bool noise_gate    = false;  // Attenuate captured audio that stays near the noise floor
+    bool agc           = false;  // Automatic gain control on captured audio
+    int32_t whisper_log_level = 4;  // 0=NONE, 1=DEBUG, 2=INFO, 3=WARN, 4=ERROR
+
+    std::string language  = "en";
+    std::string model     = "models/ggml-base.en.bin";
+    std::string vad_model = "models/ggml-silero-v5.1.2.bin";
+    std::string fast_model;      // Optional cheaper model the latency target may fall back to
+    std::string backend   = "sdl";  // Audio capture backend: sdl, pulse or alsa
+    std::string output    = "text"; // stdout format: text lines, json with timings and confidence, or edit (backspaces and text)
+    std::string device;          // Capture device name (SDL device, PulseAudio source or ALSA PCM); overrides capture_id
+    std::vector<std::string> streams;  // --stream specs, transcribed concurrently (empty = one stream from --capture/--device)
+};
+
+// Clamp params to sane values and fill in the ones that depend on others.
+// Returns false if they can't be used.
+bool whisper_params_validate(whisper_params & params);
+
+// Why an in-flight whisper_full call was cancelled
+enum abort_reason {
+    ABORT_NONE = 0,
+    ABORT_STOP,      // stop requested (SIGINT/SIGTERM) and we're discarding the segment
+    ABORT_DEADLINE,  // inference ran past --max-decode
+    ABORT_RATE,      // decoder produced implausibly many tokens for the audio length
+    ABORT_SUPERSEDED, // interim decode of a segment whose speech has since ended
+    ABORT_COUNT,
+};
+
+// Shared with whisper's abort callback, which ggml polls between graph nodes in
+// both the encoder and the decoder. Any thread may call request() to cancel the
+// current decode; the first reason wins. shut_down() cancels the current decode
+// and every later one, whenever reset() runs.
+struct inference_control {
+    std::atomic<int> reason{ABORT_NONE};
+    std::atomic<bool> shutting_down{false};
+    bool abort_on_stop = true;
+    const std::atomic<bool> * stop_requested = nullptr;  // the caller's stop flag, if any
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+
+    // Ready for the next decode. An ABORT_SUPERSEDED is kept: segment_queue
+    // only requests it for the interim this decode is about to run.
+    void reset(bool abort_on_stop_, int max_decode_ms) {
+        int current = reason;
+        while (current != ABORT_SUPERSEDED && !reason.compare_exchange_weak(current, ABORT_NONE)) {
+        }
+        abort_on_stop = abort_on_stop_;
+        deadline = max_decode_ms > 0
+            ? std::chrono::steady_clock::now() + std::chrono::milliseconds(max_decode_ms)
+            : std::chrono::steady_clock::time_point::max();
+    }
+
+    void request(abort_reason r) {
+        int expected = ABORT_NONE;
+        reason.compare_exchange_strong(expected, r);
+    }
+
+    void shut_down() {
+        shutting_down = true;
+        request(ABORT_STOP);
+    }
+};
+
+// Decode settings chosen per segment. model indexes the loaded whisper
+// contexts: 0 is --model, 1 is --fast-model.
+struct decode_config {
+    int model;
+    int beam_size;
+    int audio_ctx;  // 0 = full 30 s encoder context
+};
+
+// Inference time (ms) as a linear function of segment length (s), fit by
+// exponentially weighted least squares so it follows changes in CPU load.
+struct latency_model {
+    double w = 0, sx = 0, sy = 0, sxx = 0, sxy = 0;
+    int last_decode = 0;  // planner decode count at the latest measurement
+
+    void add(double sec, double ms) {
+        const double decay = 0.8;
+        w   = w   * decay + 1.0;
+        sx  = sx  * decay + sec;
+        sy  = sy  * decay + ms;
+        sxx = sxx * decay + sec * sec;
+        sxy = sxy * decay + sec * ms;
+    }
+
+    double predict(double sec) const {
+        const double mean_x = sx / w;
+        const double mean_y = sy / w;
+        const double var_x  = sxx / w - mean_x * mean_x;
+        if (var_x < 0.25) {
+            // Durations too similar to fit a slope; scale up from the mean but never down
+            return sec > mean_x && mean_x > 0.0 ? mean_y * sec / mean_x : mean_y;
+        }
+        const double slope = std::max(0.0, (sxy / w - mean_x * mean_y) / var_x);
+        return std::max(0.0, mean_y + slope * (sec - mean_x));
+    }
+};
+
+// Picks decode settings so the predicted inference time fits the latency
+// target. Candidates are tried in order of expected accuracy; a candidate we
+// have no (or only stale) measurements for is tried as-is so the planner keeps
+// learning, and if nothing fits we take the fastest prediction.
+struct decode_planner {
+    std::map<std::tuple<int, int, int>, latency_model> models;
+    int n_decodes = 0;
+    int generation = 0;  // whisper_models::generation the measurements are for
+};
+
+// In the idle tier we wake once per idle_step_ms and only run Silero when the
+// energy gate opens; the active tier runs the VAD on every step.
+enum power_tier {
+    TIER_ACTIVE = 0,
+    TIER_IDLE,
+    TIER_COUNT,
+};
+
+struct tier_usage {
+    double seconds = 0.0;
+    uint64_t loop_wakeups = 0;  // main loop steps
+    uint64_t nvcsw = 0;         // voluntary context switches of all our threads, i.e. wakeups
+};
+
+// Voluntary context switches so far, summed over all threads
+uint64_t voluntary_context_switches();
+
+// Page faults so far, summed over all threads. Major faults had to read from
+// disk, e.g. model weights that were paged out while we sat idle.
+struct page_faults {
+    uint64_t major = 0;
+    uint64_t minor = 0;
+};
+
+// A "Field:   N kB" line of /proc/self/status, in kB; -1 if missing
+long proc_status_kb(const char * field);
+
+// Lock everything mapped so far, which includes the model weights and the
+// compute buffers, in RAM. whisper.cpp reads the weights into buffers of its
+// own rather than mapping the model file, so this is the way to keep them
+// resident; it usually needs a higher RLIMIT_MEMLOCK (ulimit -l).
+bool lock_memory(const whisper_params & params);
+
+// Counters reported at exit with --verbose. The segmenter threads share the
+// tier accounting and max_inference_ms with the inference loop; hold mutex
+// for those. The queue counters belong to the inference loop.
+struct transcribe_stats {
+    std::mutex mutex;
+
+    int n_segments = 0;            // segments sent to whisper
+    int n_outputs = 0;             // segments that produced text
+    int n_interim = 0;             // interim decodes (--interim), not counted above
+    double audio_ms = 0.0;         // audio sent to whisper
+    double excised_ms = 0.0;       // pauses cut out of segments before inference
+    double max_inference_ms = 0.0; // slowest completed decode
+    size_t max_queue_depth = 0;    // most segments waiting for inference at once
+    double max_queue_wait_ms = 0.0; // longest a segment waited for inference
+    double first_inference_ms = -1.0; // first completed decode
+    double warmup_ms = -1.0;       // --warmup cost, or -1 without it
+    page_faults faults;            // during decodes
+    uint64_t max_major_faults = 0; // most major faults in one decode
+    audio_capture::overrun_stats overruns;  // summed over all streams at exit
+    audio_capture::gap_stats gaps;          // likewise
+    int n_aborted[ABORT_COUNT] = {};
+    int n_loops_cut = 0;           // decodes that looped and were cut short
+
+    tier_usage tiers[TIER_COUNT];
+    int tier = TIER_ACTIVE;        // idle only while every stream is
+    int n_streams = 1;
+    int n_idle_streams = 0;
+    std::chrono::steady_clock::time_point tier_since = std::chrono::steady_clock::now();
+    uint64_t tier_nvcsw_since = voluntary_context_switches();
+    std::function<void(int)> on_tier_change;  // called with the new process tier, mutex held
+};
+
+// Charge the time and wakeups since the last call to the current tier, then switch
+void enter_tier(transcribe_stats & stats, int tier);
+
+// Counters as stderr lines, for --verbose at exit
+void print_stats(const transcribe_stats & stats);
+
+// Memory tiers for the whisper models while the process is idle. The weights
+// live in each model's context; its state holds the compute buffers and KV
+// caches, the cheaper part to rebuild.
+enum memory_tier {
+    MEMORY_LOADED = 0,
+    MEMORY_RELEASED,  // states freed, weights kept
+    MEMORY_UNLOADED,  // contexts freed too
+    MEMORY_COUNT,
+};
+
+// The whisper models: 0 is --model, 1 is --fast-model. The inference thread
+// holds them with acquire_models()/release_models() around each decode. With
+// --release-after/--unload-after a manager thread steps the memory tier down
+// while the process stays idle, and reloads as soon as a stream becomes active
+// again, so the reload overlaps the speech that woke us instead of delaying
+// its text. Only the manager changes contexts and states, and only while the
+// tier isn't MEMORY_LOADED, when the inference thread keeps off them; the
+// control thread swaps a model in only while neither is using them.
+struct whisper_models {
+    std::vector<std::string> paths;
+    whisper_context_params cparams;
+    std::vector<whisper_context*> contexts;
+    std::vector<whisper_state*> states;
+
+    std::mutex mutex;
+    std::condition_variable cond;
+    int tier = MEMORY_LOADED;
+    bool busy = false;     // the inference thread is decoding
+    bool changing = false; // the manager is loading or freeing without the lock
+    bool active = true;    // some stream is active, so the models should be loaded
+    bool failed = false;   // the latest reload failed
+    bool stop = false;     // shutting down: the manager exits and model swaps give up
+    std::chrono::steady_clock::time_point idle_since;
+    std::thread manager;
+    int generation = 0;    // bumped when --control swaps a model in
+
+    // reported at exit with --verbose
+    long rss_kb[MEMORY_COUNT] = { -1, -1, -1 };  // RSS on the latest entry to each tier
+    int n_reloads = 0;
+    double max_reload_ms = 0.0;
+    double max_wait_ms = 0.0;  // longest a decode waited for a reload
+};
+
+// Load whatever is missing for the models to be usable: contexts (weights)
+// and states (compute buffers). Returns false, leaving nothing half loaded,
+// if a model can't be loaded.
+bool load_models(whisper_models & models);
+
+// Free down to the given tier
+void free_models(whisper_models & models, int tier);
+
+// Manager thread for --release-after/--unload-after; runs until models.stop
+void run_model_manager(whisper_models & models, const whisper_params & params);
+
+// Called on process tier changes; active streams want the models loaded
+void set_models_active(whisper_models & models, bool active);
+
+// RSS per memory tier and reload times, for --verbose at exit
+void print_memory_stats(const whisper_models & models);
+
+// RMS level in dBFS
+float rms_dbfs(float rms);
+
+// One capture device, or one channel of one, with its own VAD and segmenter
+// thread. All streams share the loaded models through the segment queue.
+struct transcribe_stream {
+    std::string label;
+    std::string tag;  // prefix for output and log lines; empty with a single stream
+    capture_params capture;
+    std::unique_ptr<audio_capture> audio;
+    whisper_vad_context * vad_ctx = nullptr;
+    audio_capture::overrun_stats overruns;  // as of the last check_audio_buffer
+    int tier = TIER_ACTIVE;
+    float vad_thold = 0.5f;    // onset threshold, --vad-thold until calibrated
+    float ambient_rms = 0.0f;  // ambient level found by the latest calibration
+    int n_calibrations = 0;
+    double max_step_ms = 0.0;  // slowest segmenter step (VAD, excision), which --grow-buffer covers
+    std::thread thread;
+};
+
+// Fill in a stream from a --stream spec, [LABEL=]DEVICE[@CHANNEL]. DEVICE is
+// a device name, or for the sdl backend also a capture index; empty means
+// the default device. The label defaults to the spec itself.
+void parse_stream_spec(const std::string & spec, const whisper_params & params, transcribe_stream & stream);
+
+// A finished segment waiting for inference
+struct pending_segment {
+    int stream = 0;
+    std::vector<float> samples;
+    size_t n_excised = 0;  // samples of pauses cut out before queueing
+    uint64_t begin = 0;    // capture positions of the segment's first sample
+    uint64_t end = 0;      // and one past its last, before excision
+    std::chrono::system_clock::time_point endpoint_time;  // when the end of speech was detected
+    std::chrono::steady_clock::time_point endpoint;       // the same, for durations
+    double excise_ms = 0.0;  // excise_silence(): its VAD pass and the cutting (0 without --max-gap)
+    bool interim = false;    // speech goes on; a hypothesis for the segment so far
+    int n_interim = 0;       // final segments: interims queued for it before
+};
+
+// Segments from every stream wait here for the inference loop, which decodes
+// them one at a time, in the order their speech ended. Only the newest
+// interim of a stream is worth decoding: a new one replaces any still
+// waiting, and the final segment also cancels the one being decoded, from
+// pop() to decode_done().
+struct segment_queue {
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::deque<pending_segment> segments;
+    int n_producers = 0;       // segmenter threads still running
+    bool interrupted = false;  // stop requested; queued segments are dropped
+    inference_control * control = nullptr;  // of the inference loop
+    int decoding_interim = -1; // stream whose interim is being decoded, or -1
+
+    void push(pending_segment && segment) {
+        std::lock_guard<std::mutex> lock(mutex);
+        const int stream = segment.stream;
+        segments.erase(std::remove_if(segments.begin(), segments.end(), [stream](const pending_segment & s) {
+            return s.interim && s.stream == stream;
+        }), segments.end());
+        if (!segment.interim && decoding_interim == stream && control) {
+            control->request(ABORT_SUPERSEDED);
+        }
+        segments.push_back(std::move(segment));
+        cond.notify_one();
+    }
+
+    void producer_done() {
+        std::lock_guard<std::mutex> lock(mutex);
+        n_producers--;
+        cond.notify_one();
+    }
+
+    void interrupt() {
+        std::lock_guard<std::mutex> lock(mutex);
+        interrupted = true;
+        cond.notify_one();
+    }
+
+    // Block for the next segment. Returns false once interrupted, or when
+    // every producer is done and nothing is left. n_waiting gets the number
+    // of segments still queued behind it.
+    bool pop(pending_segment & segment, size_t * n_waiting = nullptr) {
+        std::unique_lock<std::mutex> lock(mutex);
+        cond.wait(lock, [this]() { return interrupted || !segments.empty() || n_producers == 0; });
+        if (interrupted || segments.empty()) {
+            return false;
+        }
+        segment = std::move(segments.front());
+        segments.pop_front();
+        decoding_interim = segment.interim ? segment.stream : -1;
+        if (n_waiting) {
+            *n_waiting = segments.size();
+        }
+        return true;
+    }
+
+    // The segment from pop() has been decoded. A cancel that came too late
+    // to stop it mustn't carry over to the next one.
+    void decode_done() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (decoding_interim >= 0 && control) {
+            int superseded = ABORT_SUPERSEDED;
+            control->reason.compare_exchange_strong(superseded, ABORT_NONE);
+        }
+        decoding_interim = -1;
+    }
+};
+
+// What whisper made of a segment
+struct transcript {
+    std::string text;
+    int model = 0;                // index into whisper_models
+    int n_tokens = 0;             // text tokens
+    float avg_logprob = 0.0f;     // mean log probability of the text tokens
+    float no_speech_prob = 0.0f;  // highest of whisper's segments
+    bool loop_cut = false;        // whisper looped; text ends at the loop's first pass
+    double queue_ms = 0.0;        // end of speech to decode start, including any model reload
+    double decode_ms = 0.0;
+};
+
+// Receives each transcribed segment that has text, on the inference thread.
+// Interims come first if --interim is on, and then the final segment even
+// without text, so what they put out can be taken back.
+typedef std::function<void(const pending_segment & segment, const transcript & result)> transcript_sink;
+
+// Transcribe a finished segment, hand any text to sink and update the counters
+void emit_segment(
+    whisper_models& models,
+    pending_segment& segment,
+    const whisper_params& params,
+    decode_planner& planner,
+    inference_control& control,
+    transcribe_stats& stats,
+    const transcript_sink& sink);
+
+// Parameters --control can change while we run. The segmenters and the
+// inference loop each work from their own copy of whisper_params and, when
+// version moves, copy the new values in at the start of their next step or
+// segment.
+struct live_settings {
+    std::mutex mutex;
+    std::atomic<int> version{0};
+    int beam_size;
+    int n_threads;
+    float vad_thold;
+    int silence_ms;
+
+    explicit live_settings(const whisper_params & params)
+        : beam_size(params.beam_size), n_threads(params.n_threads),
+          vad_thold(params.vad_thold), silence_ms(params.silence_ms) {}
+};
+
+// Copy changed settings into params; returns true if anything changed
+bool apply_live_settings(live_settings & live, int & version, whisper_params & params);
+
+// Segmenter thread of one stream: wait for audio, run the VAD and queue each
+// finished speech segment. Returns once stop is set and the stream's audio
+// is interrupted.
+void run_segmenter(
+    transcribe_stream& stream,
+    int index,
+    whisper_params params,
+    live_settings& live,
+    segment_queue& queue,
+    transcribe_stats& stats,
+    const std::atomic<bool>& stop);
+
+// Inference loop: decode the queued segments one at a time, from any number
+// of streams, until the queue is interrupted or its producers are done
+void run_inference(
+    whisper_models& models,
+    segment_queue& queue,
+    whisper_params params,
+    live_settings& live,
+    inference_control& control,
+    transcribe_stats& stats,
+    const transcript_sink& sink);
+
+// Run each VAD and whisper context once on a synthetic voiced sound, so the
+// first real utterance doesn't pay for allocating compute buffers, faulting in
+// the weights and first use of the compute kernels. Returns the time taken (ms).
+double warm_up(
+    whisper_models& models,
+    std::vector<transcribe_stream>& streams,
+    const whisper_params& params);
+
+// Load PATH as whisper model index (0 = --model, 1 = --fast-model) and swap
+// it in once the current decode, if any, has finished. Capture and
+// segmentation carry on meanwhile, so no audio is lost. If the idle tiers
+// have freed the old model, only the parts of the new one that tier keeps
+// are kept. Returns false if PATH couldn't be loaded, or models.stop was set
+// meanwhile.
+bool swap_model(whisper_models & models, int index, const std::string & path, const whisper_params & params);
+
+// Apply "set NAME VALUE"; returns false if NAME or VALUE isn't valid
+bool set_live_setting(live_settings & live, const std::string & name, const std::string & value);
@@ -2,20 +2,32 @@
 // Based on whisper.cpp stream example but outputs only new text segments
 // Waits for silence before outputting transcribed text
 
-#include "common-sdl.h"
+#include "transcribe-pipeline.h"
 #include "common.h"
 #include "common-whisper.h"
 #include "whisper.h"
 #include <SDL.h>
 
+#include <poll.h>
+#include <unistd.h>
+
 #include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <cerrno>
+#include <csignal>
 #include <cstdio>
+#include <ctime>
+#include <deque>
+#include <functional>
+#include <mutex>
 #include <string>
 #include <thread>
 #include <vector>
-#include <set>
 #include <fstream>
+#include <iostream>
+#include <sstream>
 
 // Global variable to store the minimum log level
 static int g_whisper_log_level = GGML_LOG_LEVEL_ERROR;
@@ -30,32 +42,56 @@ static void whisper_log_callback_filtered(ggml_log_level level, const char * tex
     }
 }
 
-// command-line parameters
-struct whisper_params {
-    int32_t n_threads  = std::min(4, (int32_t) std::thread::hardware_concurrency());
-    int32_t capture_id = -1;
-    int32_t max_tokens = 128;
-    int32_t audio_ctx  = 0;
-
-    int32_t audio_buffer_ms = 2000;  // Audio buffer duration - must be longer than transcription time
-    int32_t silence_ms = 500;    // Silence duration before outputting text
-    int32_t min_step_ms = 500;   // Minimum time between audio collection steps
-    int32_t beam_size = 5;       // Beam search size (0 or 1 = greedy, 2+ = beam search)
-    float vad_thold    = 0.5f;   // VAD speech probability threshold
-
-    bool no_fallback   = true;
-    bool use_gpu       = true;
-    bool flash_attn    = false;
-    bool verbose       = false;
-    bool list_devices  = false;
-    int32_t whisper_log_level = 4;  // 0=NONE, 1=DEBUG, 2=INFO, 3=WARN, 4=ERROR
-
-    std::string language  = "en";
-    std::string model     = "models/ggml-base.en.bin";
-    std::string vad_model = "models/ggml-silero-v5.1.2.bin";
+// Set when SIGINT/SIGTERM arrives. The signals are blocked in every thread and
+// taken with sigwait() on a dedicated thread, which can then wake the threads
+// blocked waiting for audio or segments as well as abort a running whisper_full.
+static std::atomic<bool> g_stop_requested(false);
+
+static sigset_t stop_signal_set() {
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGTERM);
+    return set;
+}
+
+// Call before any other thread is started so they all inherit the mask
+static void block_stop_signals() {
+    sigset_t set = stop_signal_set();
+    pthread_sigmask(SIG_BLOCK, &set, nullptr);
+}
+
+// The signal thread: on_stop runs on it after g_stop_requested is set. It is
+// woken and joined on destruction, so declare it after whatever on_stop
+// touches and it can't outlive those.
+class stop_signal_thread {
+public:
+    explicit stop_signal_thread(std::function<void()> on_stop)
+        : m_thread([this, on_stop]() {
+              sigset_t set = stop_signal_set();
+              int signum = 0;
+              sigwait(&set, &signum);
+              if (m_exiting) {
+                  return;
+              }
+              g_stop_requested = true;
+              on_stop();
+          }) {}
+
+    // A SIGTERM of our own ends the sigwait if no signal has yet
+    ~stop_signal_thread() {
+        m_exiting = true;
+        pthread_kill(m_thread.native_handle(), SIGTERM);
+        m_thread.join();
+    }
+
+private:
+    std::atomic<bool> m_exiting{false};
+    std::thread m_thread;
 };
 
 static bool whisper_params_parse(int argc, char ** argv, whisper_params & params) {
+    bool interim_set = false;
     for (int i = 1; i < argc; i++) {
         std::string arg = argv[i];
 
@@ -64,17 +100,50 @@ static bool whisper_params_parse(int argc, char ** argv, whisper_params & params
             fprintf(stderr, "  -t N,     --threads N     [%-7d] number of threads\n", params.n_threads);
             fprintf(stderr, "  -l LANG,  --language LANG [%-7s] spoken language\n", params.language.c_str());
             fprintf(stderr, "  -m FNAME, --model FNAME   [%-7s] model path\n", params.model.c_str());
+            fprintf(stderr, "  --fast-model FNAME        [%-7s] cheaper model to fall back to under --latency-target\n", params.fast_model.empty() ? "none" : params.fast_model.c_str());
             fprintf(stderr, "  --vad-model FNAME         [%-7s] VAD model path\n", params.vad_model.c_str());
-            fprintf(stderr, "  -c ID,    --capture ID    [%-7d] capture device ID\n", params.capture_id);
+            fprintf(stderr, "  -c ID,    --capture ID    [%-7d] capture device ID (sdl backend)\n", params.capture_id);
+            fprintf(stderr, "  --backend NAME            [%-7s] audio capture backend (built with: %s)\n", params.backend.c_str(), audio_capture_backends().c_str());
+            fprintf(stderr, "  --device NAME             [%-7s] capture device name: SDL device, PulseAudio source or ALSA PCM\n", params.device.empty() ? "default" : params.device.c_str());
+            fprintf(stderr, "  --stream SPEC             [%-7s] transcribe [LABEL=]DEVICE[@CHANNEL]; repeat for several devices or channels at once\n", "none");
+            fprintf(stderr, "  --capture-rate N          [%-7d] open the device at N Hz and resample to 16 kHz ourselves (0 = native with sdl, 48000 otherwise)\n", params.capture_rate);
+            fprintf(stderr, "  --period N                [%-7d] capture period (ms, 0 = backend default)\n", params.period_ms);
+            fprintf(stderr, "  --highpass N              [%-7.0f] high-pass captured audio at N Hz against hum and rumble (0 = off)\n", params.highpass_hz);
+            fprintf(stderr, "  --noise-gate              [%-7s] attenuate captured audio near the noise floor\n", params.noise_gate ? "true" : "false");
+            fprintf(stderr, "  --agc                     [%-7s] automatic gain control on captured audio\n", params.agc ? "true" : "false");
             fprintf(stderr, "  --audio-buffer N          [%-7d] audio buffer duration (ms)\n", params.audio_buffer_ms);
+            fprintf(stderr, "  --grow-buffer             [%-7s] grow the audio buffer automatically when segmentation falls behind\n", params.grow_buffer ? "true" : "false");
             fprintf(stderr, "  --silence N               [%-7d] silence duration before output (ms)\n", params.silence_ms);
-            fprintf(stderr, "  --min-step N              [%-7d] minimum time between audio steps (ms)\n", params.min_step_ms);
+            fprintf(stderr, "  --pre-roll N              [%-7d] audio kept from before speech onset (ms)\n", params.pre_roll_ms);
+            fprintf(stderr, "  --max-gap N               [%-7d] shorten pauses inside a segment to N ms before inference (0 = off)\n", params.max_gap_ms);
+            fprintf(stderr, "  --min-step N              [%-7d] audio collected per processing step (ms)\n", params.min_step_ms);
+            fprintf(stderr, "  --idle-after N            [%-7d] seconds without speech before the low-power idle tier (0 = never)\n", params.idle_after_s);
+            fprintf(stderr, "  --idle-step N             [%-7d] audio collected per processing step when idle (ms)\n", params.idle_step_ms);
             fprintf(stderr, "  --beam-size N             [%-7d] beam search size (0 or 1 = greedy, 2+ = beam search)\n", params.beam_size);
             fprintf(stderr, "  -vth N,   --vad-thold N   [%-7.2f] VAD speech probability threshold\n", params.vad_thold);
+            fprintf(stderr, "  --calibrate N             [%-7d] set the VAD threshold from N s of ambient audio at startup (0 = off)\n", params.calibrate_s);
+            fprintf(stderr, "  --recalibrate N           [%-7d] calibrate again every N minutes while idle (0 = never)\n", params.recalibrate_min);
+            fprintf(stderr, "  --release-after N         [%-7d] free whisper compute buffers after N s idle (0 = never; needs --idle-after)\n", params.release_after_s);
+            fprintf(stderr, "  --unload-after N          [%-7d] unload the whisper models after N minutes idle (0 = never; needs --idle-after)\n", params.unload_after_min);
+            fprintf(stderr, "  --latency-target N        [%-7d] end of speech to text target (ms); adapts beam size, audio_ctx and model (0 = off)\n", params.latency_target_ms);
+            fprintf(stderr, "  --max-decode N            [%-7d] abort inference after N ms (0 = no limit)\n", params.max_decode_ms);
+            fprintf(stderr, "  --repeat-limit N          [%-7d] end a decoder's text where it repeats an n-gram N times in a row over 16+ tokens (0 = off)\n", params.repeat_limit);
+            fprintf(stderr, "  --max-tokens N            [%-7d] maximum tokens per segment\n", params.max_tokens);
+            fprintf(stderr, "  --max-wps N               [%-7.1f] words per second ceiling for the per-segment token budget (0 = off)\n", params.max_wps);
+            fprintf(stderr, "  --max-tps N               [%-7.1f] abort decodes producing more than N tokens per second of audio (0 = off)\n", params.max_tps);
+            fprintf(stderr, "  --output MODE             [%-7s] text; json: one object per segment with timings and confidence; edit: backspaces<TAB>text per hypothesis\n", params.output.c_str());
+            fprintf(stderr, "  --interim N               [%-7d] decode the segment so far every N ms of speech, for json and edit output (0 = off; edit defaults to 1000)\n", params.interim_ms);
+            fprintf(stderr, "  --output-queue N          [%-7d] segments waiting for a slow stdout reader; past that, finals of a stream are joined and interims dropped\n", params.output_queue);
+            fprintf(stderr, "  --on-stop MODE            [%-7s] on SIGINT/SIGTERM: discard (abort inference) or flush (output current segment)\n", params.flush_on_stop ? "flush" : "discard");
             fprintf(stderr, "  --no-gpu                  [%-7s] disable GPU\n", params.use_gpu ? "false" : "true");
             fprintf(stderr, "  -fa,      --flash-attn    [%-7s] enable flash attention\n", params.flash_attn ? "true" : "false");
             fprintf(stderr, "  -v,       --verbose       [%-7s] enable verbose/debug output\n", params.verbose ? "true" : "false");
-            fprintf(stderr, "  --list-devices            [%-7s] list available audio capture devices and exit\n", "false");
+            fprintf(stderr, "  --list-devices            [%-7s] list SDL capture devices as JSON lines and exit (sdl backend only)\n", "false");
+            fprintf(stderr, "  --warmup                  [%-7s] run the models once at startup so the first utterance isn't slow\n", params.warmup ? "true" : "false");
+            fprintf(stderr, "  --mlock                   [%-7s] lock the loaded models in RAM (may need a higher ulimit -l)\n", params.mlock ? "true" : "false");
+            fprintf(stderr, "  --control                 [%-7s] read commands from stdin: model PATH, fast-model PATH, set NAME VALUE\n", params.control ? "true" : "false");
+            fprintf(stderr, "  --startup-timing          [%-7s] print the time taken by each startup phase\n", params.startup_timing ? "true" : "false");
+            fprintf(stderr, "  --exit-when-ready         [%-7s] exit once ready to listen (for startup benchmarks)\n", params.exit_when_ready ? "true" : "false");
             fprintf(stderr, "  --whisper-log-level N     [%-7d] whisper log level (0=NONE, 1=DEBUG, 2=INFO, 3=WARN, 4=ERROR)\n", params.whisper_log_level);
             exit(0);
         }
@@ -82,16 +151,62 @@ static bool whisper_params_parse(int argc, char ** argv, whisper_params & params
         else if (arg == "-l"    || arg == "--language")  { params.language   = argv[++i]; }
         else if (arg == "-m"    || arg == "--model")     { params.model      = argv[++i]; }
         else if (                  arg == "--vad-model") { params.vad_model  = argv[++i]; }
+        else if (                  arg == "--fast-model") { params.fast_model = argv[++i]; }
         else if (arg == "-c"    || arg == "--capture")   { params.capture_id = std::stoi(argv[++i]); }
+        else if (                  arg == "--backend")   { params.backend    = argv[++i]; }
+        else if (                  arg == "--device")    { params.device     = argv[++i]; }
+        else if (                  arg == "--stream")    { params.streams.push_back(argv[++i]); }
+        else if (                  arg == "--capture-rate") { params.capture_rate = std::stoi(argv[++i]); }
+        else if (                  arg == "--period")    { params.period_ms  = std::stoi(argv[++i]); }
+        else if (                  arg == "--highpass")  { params.highpass_hz = std::stof(argv[++i]); }
+        else if (                  arg == "--noise-gate") { params.noise_gate = true; }
+        else if (                  arg == "--agc")       { params.agc        = true; }
         else if (                  arg == "--audio-buffer") { params.audio_buffer_ms = std::stoi(argv[++i]); }
+        else if (                  arg == "--grow-buffer") { params.grow_buffer = true; }
         else if (                  arg == "--silence")   { params.silence_ms = std::stoi(argv[++i]); }
+        else if (                  arg == "--pre-roll")  { params.pre_roll_ms = std::stoi(argv[++i]); }
+        else if (                  arg == "--max-gap")   { params.max_gap_ms = std::stoi(argv[++i]); }
         else if (                  arg == "--min-step")  { params.min_step_ms = std::stoi(argv[++i]); }
+        else if (                  arg == "--idle-after") { params.idle_after_s = std::stoi(argv[++i]); }
+        else if (                  arg == "--idle-step") { params.idle_step_ms = std::stoi(argv[++i]); }
         else if (                  arg == "--beam-size") { params.beam_size = std::stoi(argv[++i]); }
         else if (arg == "-vth"  || arg == "--vad-thold") { params.vad_thold  = std::stof(argv[++i]); }
+        else if (                  arg == "--calibrate") { params.calibrate_s = std::stoi(argv[++i]); }
+        else if (                  arg == "--recalibrate") { params.recalibrate_min = std::stoi(argv[++i]); }
+        else if (                  arg == "--release-after") { params.release_after_s = std::stoi(argv[++i]); }
+        else if (                  arg == "--unload-after") { params.unload_after_min = std::stoi(argv[++i]); }
+        else if (                  arg == "--latency-target") { params.latency_target_ms = std::stoi(argv[++i]); }
+        else if (                  arg == "--max-decode") { params.max_decode_ms = std::stoi(argv[++i]); }
+        else if (                  arg == "--repeat-limit") { params.repeat_limit = std::stoi(argv[++i]); }
+        else if (                  arg == "--max-tokens") { params.max_tokens = std::stoi(argv[++i]); }
+        else if (                  arg == "--max-wps")   { params.max_wps = std::stof(argv[++i]); }
+        else if (                  arg == "--max-tps")   { params.max_tps = std::stof(argv[++i]); }
+        else if (                  arg == "--output") {
+            params.output = argv[++i];
+            if (params.output != "text" && params.output != "json" && params.output != "edit") {
+                fprintf(stderr, "error: unknown --output mode '%s' (expected text, json or edit)\n", params.output.c_str());
+                exit(1);
+            }
+        }
+        else if (                  arg == "--interim")   { params.interim_ms = std::stoi(argv[++i]); interim_set = true; }
+        else if (                  arg == "--output-queue") { params.output_queue = std::stoi(argv[++i]); }
+        else if (                  arg == "--on-stop") {
+            std::string mode = argv[++i];
+            if (mode != "discard" && mode != "flush") {
+                fprintf(stderr, "error: unknown --on-stop mode '%s' (expected discard or flush)\n", mode.c_str());
+                exit(1);
+            }
+            params.flush_on_stop = (mode == "flush");
+        }
         else if (                  arg == "--no-gpu")    { params.use_gpu    = false; }
         else if (arg == "-fa"   || arg == "--flash-attn") { params.flash_attn = true; }
         else if (arg == "-v"    || arg == "--verbose")   { params.verbose    = true; }
         else if (                  arg == "--list-devices") { params.list_devices = true; }
+        else if (                  arg == "--warmup")    { params.warmup = true; }
+        else if (                  arg == "--mlock")     { params.mlock = true; }
+        else if (                  arg == "--control")   { params.control = true; }
+        else if (                  arg == "--startup-timing") { params.startup_timing = true; }
+        else if (                  arg == "--exit-when-ready") { params.exit_when_ready = true; }
         else if (                  arg == "--whisper-log-level") { params.whisper_log_level = std::stoi(argv[++i]); }
         else {
             fprintf(stderr, "error: unknown argument: %s\n", arg.c_str());
@@ -99,126 +214,342 @@ static bool whisper_params_parse(int argc, char ** argv, whisper_params & params
         }
     }
 
-    // Parameter validation
-    params.audio_buffer_ms = std::max(params.audio_buffer_ms, 1000);
-    params.silence_ms = std::max(params.silence_ms, 500);
-    params.min_step_ms = std::max(params.min_step_ms, 100);
-    params.whisper_log_level = std::max(0, std::min(params.whisper_log_level, 5));
+    // Edits are typed at one cursor, so they can't interleave several streams
+    if (params.output == "edit") {
+        if (params.streams.size() > 1) {
+            fprintf(stderr, "error: --output edit takes a single stream\n");
+            return false;
+        }
+        if (!interim_set) {
+            params.interim_ms = 1000;
+        }
+    }
+
+    return whisper_params_validate(params);
+}
 
-    // Language validation
-    if (params.language != "auto" && whisper_lang_id(params.language.c_str()) == -1) {
-        fprintf(stderr, "error: unknown language '%s'\n", params.language.c_str());
-        return false;
+// Quote s as a JSON string
+static std::string json_string(const std::string & s) {
+    std::string out = "\"";
+    for (unsigned char c : s) {
+        switch (c) {
+            case '"':  out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if (c < 0x20) {
+                    char escaped[8];
+                    snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                    out += escaped;
+                } else {
+                    out += (char) c;
+                }
+        }
     }
+    return out + "\"";
+}
 
-    return true;
+// One --output json line per segment: its text; where its audio lies in the
+// stream's capture, as 16 kHz sample positions before --max-gap excision;
+// when the end of speech was detected and when the text went out (Unix
+// time); how long each stage took (excise_ms is the VAD pass and pause
+// removal of --max-gap, 0 without it);
+// and how sure whisper was of it. segments is more than 1 when output_writer
+// joined several segments into this one; interim lines (--interim) hold a
+// hypothesis for speech still going on, which later lines replace.
+static std::string transcript_json(const std::string & label, const pending_segment & segment, const transcript & result, int n_segments) {
+    const auto emit_time = std::chrono::system_clock::now();
+    const double latency_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - segment.endpoint).count();
+    char fields[512];
+    snprintf(fields, sizeof(fields),
+             "\"start_sample\": %llu, \"end_sample\": %llu, \"endpoint_time\": %.3f, \"emit_time\": %.3f, "
+             "\"excise_ms\": %.1f, \"queue_ms\": %.1f, \"decode_ms\": %.1f, \"latency_ms\": %.1f, "
+             "\"model\": %d, \"tokens\": %d, \"avg_logprob\": %.4f, \"no_speech_prob\": %.4f, \"segments\": %d, \"interim\": %s",
+             (unsigned long long) segment.begin, (unsigned long long) segment.end,
+             std::chrono::duration<double>(segment.endpoint_time.time_since_epoch()).count(),
+             std::chrono::duration<double>(emit_time.time_since_epoch()).count(),
+             segment.excise_ms, result.queue_ms, result.decode_ms, latency_ms,
+             result.model, result.n_tokens, result.avg_logprob, result.no_speech_prob, n_segments,
+             segment.interim ? "true" : "false");
+    return "{\"stream\": " + json_string(label) + ", \"text\": " + json_string(result.text) + ", " + fields + "}";
 }
 
-// Detect voice activity using Silero VAD
-static bool detect_voice_activity(
-    whisper_vad_context* vad_ctx,
-    const std::vector<float>& audio_samples,
-    float vad_threshold) {
+// Characters, as opposed to bytes, in UTF-8 text; one backspace each
+static int utf8_length(const std::string & s) {
+    int n = 0;
+    for (unsigned char c : s) {
+        if ((c & 0xC0) != 0x80) {
+            n++;
+        }
+    }
+    return n;
+}
 
-    if (!vad_ctx || audio_samples.empty()) {
-        return false;
+// The edit that turns typed into target at word granularity: keep the words
+// they start with in common, erase the rest of typed with n_backspace
+// backspaces, then type suffix. A word that only partly matches is retyped.
+static void word_edit(const std::string & typed, const std::string & target, int & n_backspace, std::string & suffix) {
+    size_t keep = 0;
+    size_t i = 0;
+    while (i < typed.size() && i < target.size() && typed[i] == target[i]) {
+        ++i;
+        if (typed[i - 1] == ' ') {
+            keep = i;
+        }
     }
+    // All of typed matches, up to a word boundary in target
+    if (i == typed.size() && (i == target.size() || target[i] == ' ')) {
+        keep = i;
+    }
+    n_backspace = utf8_length(typed.substr(keep));
+    suffix = target.substr(keep);
+}
 
-    // Run VAD detection
-    bool vad_success = whisper_vad_detect_speech(vad_ctx, audio_samples.data(), audio_samples.size());
-    if (!vad_success) {
-        return false;
+// A write to stdout that takes longer than this counts as a stall
+static const double OUTPUT_STALL_MS = 50.0;
+
+// Writes the output lines on a thread of its own, so a slow reader of stdout
+// (xdotool still typing, a stuck pipe) holds up neither the inference thread
+// nor, behind it, capture. The lines waiting when the writer gets to them go
+// out in a single write. A waiting interim is replaced by whatever its stream
+// sends next. At most params.output_queue segments wait: past that, a new
+// final is joined onto the last one waiting from its stream, or else makes
+// room by dropping a waiting interim or joining two waiting finals of one
+// stream, and a new interim is dropped, so final text is merged, never lost.
+// Only with more streams than that, each with one final waiting, can the
+// queue grow past it.
+//
+// With --output edit the writer keeps what it has typed of each stream's
+// current segment, and writes each hypothesis as the backspaces and text that
+// turn one into the other. Edits are worked out as lines go out, against
+// what was actually typed, so replacing or joining waiting entries is safe.
+class output_writer {
+public:
+    output_writer(const whisper_params & params, const std::vector<transcribe_stream> & streams)
+        : m_params(params), m_streams(streams), m_typed(streams.size()) {}
+
+    void start() {
+        m_thread = std::thread(&output_writer::run, this);
     }
 
-    // Get speech probabilities from VAD context
-    int n_probs = whisper_vad_n_probs(vad_ctx);
-    float* probs = whisper_vad_probs(vad_ctx);
+    // Called on the inference thread; never waits for stdout
+    void push(const pending_segment & segment, const transcript & result) {
+        // Plain text can't take back interims, nor needs the final without
+        // text that does that
+        if (m_params.output == "text" && (segment.interim || result.text.empty())) {
+            return;
+        }
 
-    if (n_probs <= 0 || probs == nullptr) {
-        return false;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        entry * last = nullptr;
+        for (auto it = m_entries.rbegin(); it != m_entries.rend(); ++it) {
+            if (it->segment.stream == segment.stream) {
+                last = &*it;
+                break;
+            }
+        }
+        if (last && last->segment.interim) {
+            last->segment = entry_segment(segment);
+            last->result = result;
+            m_n_superseded++;
+            return;
+        }
+        const bool full = (int) m_entries.size() >= m_params.output_queue;
+        if (full && last && !segment.interim) {
+            join(*last, segment, result);
+            m_n_joined++;
+            return;
+        }
+        if (full && segment.interim) {
+            m_n_dropped++;
+            return;
+        }
+        if (full) {
+            make_room();
+        }
+
+        entry e;
+        e.segment = entry_segment(segment);
+        e.result = result;
+        m_entries.push_back(std::move(e));
+        m_max_depth = std::max(m_max_depth, (int) m_entries.size());
+        m_cond.notify_one();
     }
 
-    // Use maximum probability across all chunks (most sensitive to any speech activity)
-    float max_prob = *std::max_element(probs, probs + n_probs);
+    // Write whatever is still waiting and stop the thread
+    void finish() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_done = true;
+        }
+        m_cond.notify_one();
+        if (m_thread.joinable()) {
+            m_thread.join();
+        }
+    }
 
-    bool voice_detected = max_prob > vad_threshold;
+    // Counters as stderr lines, for --verbose at exit
+    void print_stats() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        fprintf(stderr, "%s: output: %d writes, at most %d segments waiting, %d joined into others, %d interims replaced, %d dropped\n", __func__,
+                m_n_writes, m_max_depth, m_n_joined, m_n_superseded, m_n_dropped);
+        fprintf(stderr, "%s: output: %.0f ms writing in total, slowest write %.0f ms, %d writes over %.0f ms\n", __func__,
+                m_write_ms, m_max_write_ms, m_n_stalls, OUTPUT_STALL_MS);
+    }
 
-    return voice_detected;
-}
+private:
+    struct entry {
+        pending_segment segment;  // without its samples
+        transcript result;
+        int n_segments = 1;
+    };
+
+    // segment without its samples
+    static pending_segment entry_segment(const pending_segment & segment) {
+        pending_segment s;
+        s.stream = segment.stream;
+        s.n_excised = segment.n_excised;
+        s.begin = segment.begin;
+        s.end = segment.end;
+        s.endpoint_time = segment.endpoint_time;
+        s.endpoint = segment.endpoint;
+        s.excise_ms = segment.excise_ms;
+        s.interim = segment.interim;
+        s.n_interim = segment.n_interim;
+        return s;
+    }
 
-static std::string transcribe_audio_segment(
-    whisper_context* ctx,
-    const std::vector<float>& pcmf32_segment,
-    const whisper_params& params) {
-    
-    if (pcmf32_segment.empty()) {
-        return "";
+    // Append final segment to final e as if they had been one, spanning both
+    static void join(entry & e, const pending_segment & segment, const transcript & result) {
+        const int n_tokens = e.result.n_tokens + result.n_tokens;
+        if (n_tokens > 0) {
+            e.result.avg_logprob = (e.result.avg_logprob * e.result.n_tokens + result.avg_logprob * result.n_tokens) / n_tokens;
+        }
+        e.result.n_tokens = n_tokens;
+        if (!result.text.empty()) {
+            e.result.text += (e.result.text.empty() ? "" : " ") + result.text;
+        }
+        e.result.model = result.model;
+        e.result.no_speech_prob = std::max(e.result.no_speech_prob, result.no_speech_prob);
+        e.result.decode_ms += result.decode_ms;
+        e.segment.n_excised += segment.n_excised;
+        e.segment.end = segment.end;
+        e.segment.endpoint_time = segment.endpoint_time;
+        e.segment.endpoint = segment.endpoint;
+        e.segment.excise_ms += segment.excise_ms;
+        e.segment.n_interim += segment.n_interim;
+        e.n_segments++;
     }
-    
-    if (params.verbose) {
-        fprintf(stderr, "[DEBUG] Running whisper inference on %.1f seconds of audio\n",
-                pcmf32_segment.size() / (float)WHISPER_SAMPLE_RATE);
-    }
-
-    auto t_start = std::chrono::high_resolution_clock::now();
-    
-    // Run whisper inference
-    // Choose strategy based on beam_size parameter
-    whisper_sampling_strategy strategy = (params.beam_size <= 1) ? WHISPER_SAMPLING_GREEDY : WHISPER_SAMPLING_BEAM_SEARCH;
-    whisper_full_params wparams = whisper_full_default_params(strategy);
-    wparams.print_progress   = false;
-    wparams.print_special    = false;  // Always hide special tokens
-    wparams.print_realtime   = false;
-    wparams.print_timestamps = false;
-    wparams.suppress_nst     = true;   // Suppress non-speech tokens
-    wparams.translate        = false;  // Always transcribe in original language
-    wparams.single_segment   = false;
-    wparams.max_tokens       = params.max_tokens;
-    wparams.language         = params.language.c_str();
-    wparams.n_threads        = params.n_threads;
-    wparams.audio_ctx        = params.audio_ctx;
-    wparams.temperature_inc  = params.no_fallback ? 0.0f : wparams.temperature_inc;
-
-    // Set beam size for beam search strategy
-    if (strategy == WHISPER_SAMPLING_BEAM_SEARCH) {
-        wparams.beam_search.beam_size = params.beam_size;
-    }
-
-    if (whisper_full(ctx, wparams, pcmf32_segment.data(), pcmf32_segment.size()) == 0) {
-        auto t_end = std::chrono::high_resolution_clock::now();
-        auto inference_time = std::chrono::duration_cast<std::chrono::milliseconds>(t_end - t_start).count();
-
-        if (params.verbose) {
-            float audio_duration = pcmf32_segment.size() / (float)WHISPER_SAMPLE_RATE * 1000.0f; // ms
-            float real_time_factor = audio_duration / inference_time;
-            fprintf(stderr, "[DEBUG] Inference completed in %ld ms (%.1fx real-time, flash_attn=%s)\n",
-                    inference_time, real_time_factor, params.flash_attn ? "on" : "off");
-        }
-
-        // Extract and output text segments
-        const int n_segments = whisper_full_n_segments(ctx);
-        std::string full_text;
-
-        for (int i = 0; i < n_segments; ++i) {
-            const char * text = whisper_full_get_segment_text(ctx, i);
-            if (text && strlen(text) > 0) {
-                full_text += text;
+
+    // Free a place in the full queue for a final with nothing waiting from its
+    // stream: drop the oldest waiting interim (its stream's next line replaces
+    // what it would have typed), or else join the oldest final that has
+    // another from its stream behind it with that one. m_mutex held.
+    void make_room() {
+        for (auto it = m_entries.begin(); it != m_entries.end(); ++it) {
+            if (it->segment.interim) {
+                m_entries.erase(it);
+                m_n_dropped++;
+                return;
             }
         }
+        for (auto it = m_entries.begin(); it != m_entries.end(); ++it) {
+            for (auto next = it + 1; next != m_entries.end(); ++next) {
+                if (next->segment.stream == it->segment.stream) {
+                    join(*it, next->segment, next->result);
+                    it->n_segments += next->n_segments - 1;
+                    m_entries.erase(next);
+                    m_n_joined++;
+                    return;
+                }
+            }
+        }
+    }
 
-        // Clean up the text (remove leading/trailing whitespace)
-        return ::trim(full_text);
+    void run() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (true) {
+            m_cond.wait(lock, [this]() { return !m_entries.empty() || m_done; });
+            if (m_entries.empty()) {
+                break;
+            }
+            std::deque<entry> batch;
+            batch.swap(m_entries);
+            lock.unlock();
+
+            // Formatted just before writing, so emit_time is when the line went out
+            std::string lines;
+            for (const entry & e : batch) {
+                const transcribe_stream & stream = m_streams[e.segment.stream];
+                if (m_params.output == "json") {
+                    lines += transcript_json(stream.label, e.segment, e.result, e.n_segments);
+                } else if (m_params.output == "edit") {
+                    // A final segment is typed with a space after it, as the
+                    // tray app does with text lines, and then left alone
+                    std::string & typed = m_typed[e.segment.stream];
+                    const std::string target = e.segment.interim || e.result.text.empty() ? e.result.text : e.result.text + " ";
+                    int n_backspace = 0;
+                    std::string suffix;
+                    word_edit(typed, target, n_backspace, suffix);
+                    typed = e.segment.interim ? target : "";
+                    lines += std::to_string(n_backspace) + "\t" + suffix;
+                } else {
+                    lines += stream.tag + e.result.text;
+                }
+                lines += "\n";
+            }
+            const auto t_start = std::chrono::steady_clock::now();
+            fwrite(lines.data(), 1, lines.size(), stdout);
+            fflush(stdout);
+            const double write_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t_start).count();
+
+            lock.lock();
+            m_n_writes++;
+            m_write_ms += write_ms;
+            m_max_write_ms = std::max(m_max_write_ms, write_ms);
+            if (write_ms > OUTPUT_STALL_MS) {
+                m_n_stalls++;
+                if (m_params.verbose) {
+                    fprintf(stderr, "[DEBUG] stdout stalled for %.0f ms, %d segments waiting meanwhile\n",
+                            write_ms, (int) m_entries.size());
+                }
+            }
+        }
     }
-    
-    return "";
-}
 
-// List available audio capture devices
-static void list_audio_devices() {
+    const whisper_params & m_params;
+    const std::vector<transcribe_stream> & m_streams;
+    std::vector<std::string> m_typed;  // --output edit: typed of each stream's current segment
+    std::thread m_thread;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::deque<entry> m_entries;
+    bool m_done = false;
+
+    int m_n_writes = 0;
+    int m_max_depth = 0;
+    int m_n_joined = 0;
+    int m_n_superseded = 0;
+    int m_n_dropped = 0;  // interims dropped from a full queue
+    int m_n_stalls = 0;
+    double m_write_ms = 0.0;
+    double m_max_write_ms = 0.0;
+};
+
+// List available audio capture devices, one JSON object per line:
+// {"index": 0, "name": "...", "default": true, "rate": 48000, "channels": 2}
+// rate and channels are the device's preferred format as SDL reports it (0 if
+// unknown); SDL doesn't enumerate every supported format. Older SDL can't
+// tell: default needs SDL 2.24, rate and channels 2.0.16. Runs before any
+// ggml backend or model is loaded, so the tray app can call it freely.
+static int list_audio_devices() {
     // Initialize SDL audio subsystem
     if (SDL_Init(SDL_INIT_AUDIO) < 0) {
         fprintf(stderr, "error: failed to initialize SDL audio: %s\n", SDL_GetError());
-        return;
+        return 1;
     }
 
     // Get number of recording devices
@@ -226,24 +557,157 @@ static void list_audio_devices() {
     if (num_devices < 0) {
         fprintf(stderr, "error: failed to get audio devices: %s\n", SDL_GetError());
         SDL_Quit();
-        return;
+        return 1;
     }
 
+    std::string default_name;
+    SDL_AudioSpec spec;
+#if SDL_VERSION_ATLEAST(2, 24, 0)
+    char * name = nullptr;
+    if (SDL_GetDefaultAudioInfo(&name, &spec, 1) == 0 && name) {
+        default_name = name;
+        SDL_free(name);
+    }
+#endif
+
     // List all available capture devices
     for (int i = 0; i < num_devices; i++) {
         const char* device_name = SDL_GetAudioDeviceName(i, 1);
-        if (device_name) {
-            printf("%d: %s\n", i, device_name);
-        } else {
-            printf("%d: Unknown Device\n", i);
-        }
+        SDL_zero(spec);
+#if SDL_VERSION_ATLEAST(2, 0, 16)
+        SDL_GetAudioDeviceSpec(i, 1, &spec);
+#endif
+        printf("{\"index\": %d, \"name\": %s, \"default\": %s, \"rate\": %d, \"channels\": %d}\n",
+               i, json_string(device_name ? device_name : "Unknown Device").c_str(),
+               device_name && default_name == device_name ? "true" : "false",
+               spec.freq, (int) spec.channels);
     }
+    fflush(stdout);
 
     SDL_Quit();
+    return 0;
+}
+
+// --control: one command per line on stdin
+//   model PATH        load PATH and switch to it between segments
+//   fast-model PATH   likewise for the --latency-target fallback model
+//   set NAME VALUE    beam_size, n_threads, vad_thold or silence_ms
+// Replies go to stderr, since stdout carries the text.
+static void run_control_command(whisper_models & models, live_settings & live, const whisper_params & params, const std::string & line) {
+    std::istringstream words(line);
+    std::string command, arg, value;
+    words >> command;
+    if (command.empty()) {
+        return;
+    }
+    if (command == "model" || command == "fast-model") {
+        std::getline(words >> std::ws, arg);  // the path may contain spaces
+        if (!arg.empty()) {
+            swap_model(models, command == "model" ? 0 : 1, arg, params);
+            return;
+        }
+    } else if (command == "set" && words >> arg >> value) {
+        if (set_live_setting(live, arg, value)) {
+            return;
+        }
+    }
+    fprintf(stderr, "control: error: can't do '%s'\n", line.c_str());
+}
+
+// Reads --control commands until stdin closes or anything is written to
+// wake_fd, which main does before it frees the models. Waits in poll()
+// rather than std::getline so it can be told to stop.
+static void run_control(whisper_models & models, live_settings & live, const whisper_params & params, int wake_fd) {
+    std::string pending;
+    char buf[512];
+    while (true) {
+        struct pollfd fds[2] = { { STDIN_FILENO, POLLIN, 0 }, { wake_fd, POLLIN, 0 } };
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        if (fds[1].revents != 0) {
+            break;
+        }
+        const ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+        if (n <= 0) {
+            break;
+        }
+        pending.append(buf, (size_t) n);
+        size_t eol;
+        while ((eol = pending.find('\n')) != std::string::npos) {
+            const std::string line = pending.substr(0, eol);
+            pending.erase(0, eol + 1);
+            run_control_command(models, live, params, line);
+        }
+    }
+}
+
+// Milliseconds since this process was created (by fork, so this includes exec
+// and dynamic linking), from its start time in /proc/self/stat. That is kept
+// in clock ticks, so the result is only good to about 10 ms. Negative if unknown.
+static double process_age_ms() {
+    std::ifstream file("/proc/self/stat");
+    std::string stat;
+    std::getline(file, stat);
+
+    // starttime is field 22; skip past the command name, which may contain
+    // spaces, to field 3
+    const size_t paren = stat.rfind(')');
+    if (paren == std::string::npos) {
+        return -1.0;
+    }
+    std::istringstream fields(stat.substr(paren + 1));
+    std::string field;
+    for (int i = 3; i <= 22; ++i) {
+        if (!(fields >> field)) {
+            return -1.0;
+        }
+    }
+
+    struct timespec now;
+    if (clock_gettime(CLOCK_BOOTTIME, &now) != 0) {
+        return -1.0;
+    }
+    const double start_ms = std::stod(field) * 1000.0 / sysconf(_SC_CLK_TCK);
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1e6 - start_ms;
 }
 
+// Wall time spent in each startup phase, for --startup-timing
+struct startup_timer {
+    std::chrono::steady_clock::time_point last = std::chrono::steady_clock::now();
+    double spawn_ms = process_age_ms();  // before main, taken as early as we can
+    std::vector<std::pair<std::string, double>> phases;
+
+    // end the current phase
+    void mark(const char * phase) {
+        const auto now = std::chrono::steady_clock::now();
+        phases.emplace_back(phase, std::chrono::duration<double, std::milli>(now - last).count());
+        last = now;
+    }
+
+    // One "startup: PHASE MS ms" line per phase, then the steady clock time at
+    // which we became ready, so a launcher can measure from its own spawn call.
+    void print() const {
+        double total = std::max(spawn_ms, 0.0);
+        if (spawn_ms >= 0.0) {
+            fprintf(stderr, "startup: %-16s %8.1f ms\n", "spawn to main", spawn_ms);
+        }
+        for (const auto & phase : phases) {
+            fprintf(stderr, "startup: %-16s %8.1f ms\n", phase.first.c_str(), phase.second);
+            total += phase.second;
+        }
+        fprintf(stderr, "startup: %-16s %8.1f ms\n", "total", total);
+        fprintf(stderr, "startup: ready at %.6f s (steady clock)\n",
+                std::chrono::duration<double>(last.time_since_epoch()).count());
+    }
+};
+
 int main(int argc, char ** argv) {
-    ggml_backend_load_all();
+    startup_timer startup;
+    block_stop_signals();
 
     // Parameter validation
     whisper_params params;
@@ -251,59 +715,124 @@ int main(int argc, char ** argv) {
         return 1;
     }
 
-    // Handle device listing request
+    // Handle device listing request, without loading any ggml backends. The
+    // list is SDL's, whose indexes and names mean nothing to pulse or alsa.
     if (params.list_devices) {
-        list_audio_devices();
-        return 0;
+        if (params.backend != "sdl") {
+            const char * hint = params.backend == "pulse" ? "; try 'pactl list short sources'"
+                              : params.backend == "alsa"  ? "; try 'arecord -L'" : "";
+            fprintf(stderr, "error: --list-devices lists SDL devices only, not %s ones%s\n", params.backend.c_str(), hint);
+            return 1;
+        }
+        return list_audio_devices();
     }
 
+    ggml_backend_load_all();
+    startup.mark("ggml backends");
+
     // Set whisper logging callback with configurable log level
     g_whisper_log_level = params.whisper_log_level;
     whisper_log_set(whisper_log_callback_filtered, nullptr);
 
     // Initialize whisper
-    struct whisper_context_params cparams = whisper_context_default_params();
-    cparams.use_gpu = params.use_gpu;
-    cparams.flash_attn = params.flash_attn;
-    struct whisper_context * ctx = whisper_init_from_file_with_params(params.model.c_str(), cparams);
-    if (ctx == nullptr) {
-        fprintf(stderr, "error: failed to initialize whisper context\n");
+    whisper_models models;
+    models.cparams = whisper_context_default_params();
+    models.cparams.use_gpu = params.use_gpu;
+    models.cparams.flash_attn = params.flash_attn;
+    models.paths.push_back(params.model);
+    if (!params.fast_model.empty()) {
+        models.paths.push_back(params.fast_model);
+    }
+    if (!load_models(models)) {
         return 2;
     }
+    startup.mark("whisper model");
+
+    // One stream per --stream, or a single one from --capture/--device
+    std::vector<transcribe_stream> streams(std::max<size_t>(params.streams.size(), 1));
+    for (size_t i = 0; i < streams.size(); ++i) {
+        transcribe_stream & stream = streams[i];
+        stream.capture.capture_id = params.capture_id;
+        stream.capture.device     = params.device;
+        if (!params.streams.empty()) {
+            parse_stream_spec(params.streams[i], params, stream);
+        }
+        if (streams.size() > 1) {
+            stream.tag = "[" + stream.label + "] ";
+        }
+        stream.capture.backend     = params.backend;
+        stream.capture.sample_rate = WHISPER_SAMPLE_RATE;
+        stream.capture.device_rate = params.capture_rate;
+        stream.capture.period_ms   = params.period_ms;
+        stream.capture.conditioning.highpass_hz = params.highpass_hz;
+        stream.capture.conditioning.noise_gate  = params.noise_gate;
+        stream.capture.conditioning.agc         = params.agc;
+    }
 
-    // Initialize Silero VAD context (CPU only - GPU VAD disabled in whisper.cpp for performance)
+    // Initialize Silero VAD contexts, one per stream since each keeps its own
+    // state (CPU only - GPU VAD disabled in whisper.cpp for performance)
     // NOTE: GPU support is hardcoded to false in whisper_vad_init_context() in src/whisper.cpp
     // Check that function if whisper.cpp is updated to see if GPU VAD support is re-enabled
     struct whisper_vad_context_params vad_cparams = whisper_vad_default_context_params();
     vad_cparams.n_threads = params.n_threads;
     vad_cparams.use_gpu = false;
-    struct whisper_vad_context * vad_ctx = whisper_vad_init_from_file_with_params(params.vad_model.c_str(), vad_cparams);
-    if (vad_ctx == nullptr) {
-        fprintf(stderr, "error: failed to initialize VAD context from %s\n", params.vad_model.c_str());
-        whisper_free(ctx);
-        return 3;
-    }
-
-    // Audio buffer allocation
-    std::vector<float> pcmf32_segment; // Audio for current speech segment
-    const int n_samples_buffer = (params.audio_buffer_ms * WHISPER_SAMPLE_RATE) / 1000;
-    std::vector<float> pcmf32_buffer(n_samples_buffer, 0.0f);
-    const int n_samples_vad = (params.silence_ms * WHISPER_SAMPLE_RATE) / 1000;
-    std::vector<float> pcmf32_vad(n_samples_vad, 0.0f);
-
-    // Initialize audio
-    audio_async audio(params.audio_buffer_ms);
-    if (!audio.init(params.capture_id, WHISPER_SAMPLE_RATE)) {
-        fprintf(stderr, "error: failed to initialize audio\n");
-        return 1;
+    for (transcribe_stream & stream : streams) {
+        stream.vad_ctx = whisper_vad_init_from_file_with_params(params.vad_model.c_str(), vad_cparams);
+        if (stream.vad_ctx == nullptr) {
+            fprintf(stderr, "error: failed to initialize VAD context from %s\n", params.vad_model.c_str());
+            for (transcribe_stream & s : streams) {
+                if (s.vad_ctx) {
+                    whisper_vad_free(s.vad_ctx);
+                }
+            }
+            free_models(models, MEMORY_UNLOADED);
+            return 3;
+        }
+    }
+    startup.mark("VAD model");
+
+    // Before opening audio, so the capture ring doesn't overrun meanwhile
+    double warmup_ms = -1.0;
+    if (params.warmup) {
+        warmup_ms = warm_up(models, streams, params);
+        startup.mark("warm-up");
     }
-    audio.resume();
-    auto last_audio_get_time = std::chrono::high_resolution_clock::now();
+
+    // After the warm-up, which may have allocated more compute buffers
+    if (params.mlock) {
+        lock_memory(params);
+        startup.mark("mlock");
+    }
+
+    // Initialize audio. Signals are handled on our own thread, not by SDL.
+    SDL_SetHint(SDL_HINT_NO_SIGNAL_HANDLERS, "1");
+    for (transcribe_stream & stream : streams) {
+        stream.audio.reset(new audio_capture(params.audio_buffer_ms));
+        if (!stream.audio->init(stream.capture)) {
+            fprintf(stderr, "error: failed to initialize audio%s%s\n",
+                    streams.size() > 1 ? " for stream " : "", streams.size() > 1 ? stream.label.c_str() : "");
+            return 1;
+        }
+    }
+    for (transcribe_stream & stream : streams) {
+        stream.audio->resume();
+    }
+    startup.mark("audio init");
+
+    segment_queue queue;
+    stop_signal_thread signal_thread([&streams, &queue, &params]() {
+        for (transcribe_stream & stream : streams) {
+            stream.audio->interrupt();
+        }
+        if (!params.flush_on_stop) {
+            queue.interrupt();
+        }
+    });
 
     // Print processing info
     if (params.verbose) {
         fprintf(stderr, "\n");
-        if (!whisper_is_multilingual(ctx)) {
+        if (!whisper_is_multilingual(models.contexts[0])) {
             if (params.language != "en") {
                 params.language = "en";
                 fprintf(stderr, "%s: WARNING: model is not multilingual, ignoring language and translation options\n", __func__);
@@ -315,6 +844,14 @@ int main(int argc, char ** argv) {
                 params.n_threads,
                 params.language.c_str());
         
+        for (transcribe_stream & stream : streams) {
+            fprintf(stderr, "%s: %scapture backend = %s, device rate = %d Hz, latency = %.1f ms\n", __func__,
+                    stream.tag.c_str(), params.backend.c_str(), stream.audio->device_rate(), stream.audio->latency_ms());
+        }
+        if (params.highpass_hz > 0.0f || params.noise_gate || params.agc) {
+            fprintf(stderr, "%s: conditioning: high-pass = %.0f Hz, noise gate = %s, AGC = %s\n", __func__,
+                    params.highpass_hz, params.noise_gate ? "on" : "off", params.agc ? "on" : "off");
+        }
         fprintf(stderr, "%s: Using Silero VAD model: %s\n", __func__, params.vad_model.c_str());
         fprintf(stderr, "%s: Silence threshold = %d ms\n", __func__, params.silence_ms);
         
@@ -322,86 +859,115 @@ int main(int argc, char ** argv) {
                 __func__, params.use_gpu ? "true" : "false", params.flash_attn ? "true" : "false");
         
         fprintf(stderr, "%s: model = %s\n", __func__, params.model.c_str());
+        if (params.latency_target_ms > 0) {
+            fprintf(stderr, "%s: latency target = %d ms, fast model = %s\n", __func__,
+                    params.latency_target_ms, params.fast_model.empty() ? "none" : params.fast_model.c_str());
+        }
         
         fprintf(stderr, "%s: Ready for transcription. Listening for speech...\n", __func__);
         fprintf(stderr, "\n");
     }
 
-    bool in_speech = false;
+    if (params.startup_timing) {
+        startup.print();
+    }
+    // The segmenters see the stop request straight away and the usual
+    // shutdown follows
+    if (params.exit_when_ready) {
+        g_stop_requested = true;
+    }
 
-    // Main processing loop
-    while (true) {
-        // Handle Ctrl + C
-        if (!sdl_poll_events()) break;
-
-        // Don't collect audio more frequently than every min_step_ms.
-        auto now = std::chrono::high_resolution_clock::now();
-        auto time_since_last = std::chrono::duration_cast<std::chrono::milliseconds>(now - last_audio_get_time).count();
-        auto sleep_duration = params.min_step_ms - time_since_last;
-        if (sleep_duration > 0) {
-            std::this_thread::sleep_for(std::chrono::milliseconds(sleep_duration));
-        }
-
-        // Fetch audio
-        now = std::chrono::high_resolution_clock::now();
-        pcmf32_buffer.clear();
-        audio.get(params.audio_buffer_ms, pcmf32_buffer);
-        auto elapsed_time_ms = std::chrono::duration_cast<std::chrono::milliseconds>(now - last_audio_get_time).count();
-        last_audio_get_time = now;
-        
-        // Determine if the last param.silence_ms contain any speech.
-        bool voice_detected = false;
-        if (pcmf32_buffer.size() >= static_cast<size_t>(n_samples_vad)) {
-            // Replace VAD buffer with the most recent samples from main buffer
-            std::copy(pcmf32_buffer.end() - n_samples_vad, pcmf32_buffer.end(), pcmf32_vad.begin());
-            voice_detected = detect_voice_activity(vad_ctx, pcmf32_vad, params.vad_thold);
-        }
-
-        if (in_speech) {
-            // Accumulate audio to speech segment.
-            size_t new_samples = (elapsed_time_ms * WHISPER_SAMPLE_RATE) / 1000;
-            new_samples = std::min(new_samples, pcmf32_buffer.size());
-            if (new_samples > 0) {
-                pcmf32_segment.insert(pcmf32_segment.end(), pcmf32_buffer.end() - new_samples, pcmf32_buffer.end());
-            }
+    inference_control control;
+    control.stop_requested = &g_stop_requested;
+    transcribe_stats stats;
+    stats.n_streams = (int) streams.size();
+    stats.warmup_ms = warmup_ms;
+
+    // --control changes these; the segmenters and the loop below each apply
+    // them to their own copy of params
+    live_settings live(params);
+    std::thread control_thread;
+    int control_wake[2] = { -1, -1 };
+    if (params.control) {
+        if (pipe(control_wake) != 0) {
+            fprintf(stderr, "error: failed to create a pipe for --control\n");
+            return 1;
         }
+        control_thread = std::thread(run_control, std::ref(models), std::ref(live), std::cref(params), control_wake[0]);
+    }
 
-        if (voice_detected && !in_speech) {
-            // Start of new speech segment
-            if (params.verbose) {
-                fprintf(stderr, "\n[DEBUG] Speech started, beginning new segment\n");
-            }
-            in_speech = true;
+    // Memory tiering follows the process power tier
+    models.rss_kb[MEMORY_LOADED] = proc_status_kb("VmRSS");
+    if (params.release_after_s > 0 || params.unload_after_min > 0) {
+        stats.on_tier_change = [&models](int tier) {
+            set_models_active(models, tier == TIER_ACTIVE);
+        };
+        models.manager = std::thread(run_model_manager, std::ref(models), std::cref(params));
+    }
 
-            // Initialize for new segment
-            pcmf32_segment.clear();
-            // Include the last vad interval so we don't truncate the first word or two.
-            pcmf32_segment.insert(pcmf32_segment.end(), pcmf32_buffer.end() - n_samples_vad, pcmf32_buffer.end());
-        }
+    // Each stream segments its own audio on its own thread; this thread runs
+    // inference for all of them on the shared model, one segment at a time.
+    queue.n_producers = (int) streams.size();
+    for (size_t i = 0; i < streams.size(); ++i) {
+        streams[i].thread = std::thread(run_segmenter, std::ref(streams[i]), (int) i, params, std::ref(live), std::ref(queue), std::ref(stats), std::cref(g_stop_requested));
+    }
 
-        if (!voice_detected && in_speech) {
-            // End of speech segment and transcribe
-            if (params.verbose) {
-                fprintf(stderr, "[DEBUG] Speech ended, transcribing segment");
-            }
+    output_writer writer(params, streams);
+    writer.start();
+    const transcript_sink print_text = [&writer](const pending_segment & segment, const transcript & result) {
+        writer.push(segment, result);
+    };
 
-            // Transcribe the audio segment
-            std::string transcribed_text = transcribe_audio_segment(ctx, pcmf32_segment, params);
-            
-            // Output the transcribed text with a space separator
-            if (!transcribed_text.empty()) {
-                printf("%s\n", transcribed_text.c_str());
-                fflush(stdout);
-            }
+    run_inference(models, queue, params, live, control, stats, print_text);
+    writer.finish();
 
-            // Reset for next speech segment
-            in_speech = false;
-            pcmf32_segment.clear();
+    for (transcribe_stream & stream : streams) {
+        stream.thread.join();
+    }
+    // Nothing may touch the models once they are freed below: a model swap
+    // that comes in now gives up (see swap_model)
+    {
+        std::lock_guard<std::mutex> lock(models.mutex);
+        models.stop = true;
+    }
+    models.cond.notify_all();
+    if (models.manager.joinable()) {
+        models.manager.join();
+    }
+    if (control_thread.joinable()) {
+        const char wake = 1;
+        if (write(control_wake[1], &wake, 1) != 1) {
+            fprintf(stderr, "%s: warning: failed to stop the control thread\n", __func__);
+        }
+        control_thread.join();
+        close(control_wake[0]);
+        close(control_wake[1]);
+    }
+
+    if (params.verbose) {
+        for (transcribe_stream & stream : streams) {
+            const audio_capture::overrun_stats overruns = stream.audio->overruns();
+            stats.overruns.n_overruns += overruns.n_overruns;
+            stats.overruns.n_lost += overruns.n_lost;
+            const audio_capture::gap_stats gaps = stream.audio->gaps();
+            stats.gaps.n_gaps += gaps.n_gaps;
+            stats.gaps.total_ms += gaps.total_ms;
+        }
+        enter_tier(stats, stats.tier);
+        print_stats(stats);
+        writer.print_stats();
+        print_memory_stats(models);
+        for (transcribe_stream & stream : streams) {
+            if (stream.n_calibrations > 0) {
+                fprintf(stderr, "%s: %sVAD threshold %.2f, ambient level %.1f dBFS (%d calibrations)\n", __func__,
+                        stream.tag.c_str(), stream.vad_thold, rms_dbfs(stream.ambient_rms), stream.n_calibrations);
+            }
         }
     }
 
-    audio.pause();
-    whisper_vad_free(vad_ctx);
-    whisper_free(ctx);
+    for (transcribe_stream & stream : streams) {
+        whisper_vad_free(stream.vad_ctx);
+    }
+    free_models(models, MEMORY_UNLOADED);
     return 0;
 }
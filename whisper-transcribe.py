@@ -3,6 +3,7 @@
 import sys
 import os
 import signal
+import socket
 import subprocess
 import json
 import logging
@@ -11,7 +12,7 @@ from typing import List, Dict, Any
 from logging.handlers import RotatingFileHandler
 
 from PyQt5.QtWidgets import QApplication, QSystemTrayIcon, QMenu, QAction, QActionGroup
-from PyQt5.QtCore import QTimer, QObject, pyqtSignal
+from PyQt5.QtCore import QObject, QSocketNotifier, pyqtSignal
 from PyQt5.QtGui import QIcon, QPixmap, QColor, QPainter
 
 
@@ -79,12 +80,59 @@ def get_active_device_id(
     return -1  # Fall back to default device
 
 
-def build_transcribe_command(script_dir: Path, device_id: int) -> str:
+# Models transcribe loads by default, relative to the script directory
+MODEL_FILES = ["models/ggml-base.en.bin", "models/ggml-silero-v5.1.2.bin"]
+
+
+def prefetch_model_files(script_dir: Path) -> None:
+    """Ask the kernel to read the models into the page cache in the background,
+    so the first transcription after login doesn't wait on the disk."""
+    for name in MODEL_FILES:
+        path = script_dir / name
+        try:
+            fd = os.open(path, os.O_RDONLY)
+        except OSError as e:
+            logger.warning(f"Could not prefetch {path}: {e}")
+            continue
+        try:
+            os.posix_fadvise(fd, 0, 0, os.POSIX_FADV_WILLNEED)
+        finally:
+            os.close(fd)
+
+
+# Decoding profiles, as transcribe settings. Switching profile while
+# transcribing sends them over transcribe's --control channel (its stdin), so
+# capture carries on and the model stays loaded.
+DECODING_PROFILES = {
+    "Accurate": {"beam_size": 5},
+    "Fast": {"beam_size": 1},
+}
+DEFAULT_PROFILE = "Accurate"
+
+
+# With live typing, transcribe writes "<backspaces>\t<text>" lines: the text
+# typed so far for the current sentence is corrected as whisper revises it.
+TYPE_LINES = "while IFS= read -r line; do printf '%s ' \"$line\" | xdotool type --clearmodifiers --file -; done"
+TYPE_EDITS = (
+    r"tab=$(printf '\t'); while IFS= read -r line; do"
+    r' n=${line%%"$tab"*}; text=${line#*"$tab"};'
+    r' if [ "$n" -gt 0 ]; then xdotool key --clearmodifiers --repeat "$n" BackSpace; fi;'
+    r""" if [ -n "$text" ]; then printf '%s' "$text" | xdotool type --clearmodifiers --file -; fi;"""
+    " done"
+)
+
+
+def build_transcribe_command(
+    script_dir: Path, device_id: int, profile: str = DEFAULT_PROFILE, live_typing: bool = False
+) -> str:
     """Build the transcription command with optional device selection"""
-    transcribe_cmd = "./build/transcribe"
+    settings = DECODING_PROFILES[profile]
+    transcribe_cmd = f"./build/transcribe --control --beam-size {settings['beam_size']}"
     if device_id >= 0:
         transcribe_cmd += f" --capture {device_id}"
-    return f"cd '{script_dir}' && {transcribe_cmd} | while IFS= read -r line; do printf '%s ' \"$line\" | xdotool type --clearmodifiers --file -; done"
+    if live_typing:
+        transcribe_cmd += " --output edit"
+    return f"cd '{script_dir}' && {transcribe_cmd} | {TYPE_EDITS if live_typing else TYPE_LINES}"
 
 
 def prepare_device_menu_items(
@@ -149,9 +197,20 @@ def fetch_audio_devices(transcribe_binary_path: Path) -> Dict[int, str]:
         logger.error(f"Unexpected error detecting audio devices: {e}")
         return {}
 
+    # One JSON object per line: index, name, default, rate, channels.
+    # Older binaries print "index: name" instead.
     devices = {}
     for line in result.stdout.strip().split("\n"):
-        if line.strip():
+        line = line.strip()
+        if not line:
+            continue
+        if line.startswith("{"):
+            try:
+                device = json.loads(line)
+                devices[int(device["index"])] = device["name"]
+            except (ValueError, KeyError) as e:
+                logger.warning(f"Ignoring malformed device line {line!r}: {e}")
+        else:
             parts = line.split(":", 1)
             if len(parts) == 2:
                 device_id = int(parts[0].strip())
@@ -209,8 +268,14 @@ class TranscriptionApp(QObject):
         self.transcribing = False
         self.transcribe_process = None
         self.tray_icon = None
+        self.signal_notifier = None
         self.audio_devices = {}
         self.preferred_device_id = -1
+        self.profile = DEFAULT_PROFILE
+        self.live_typing = False
+
+        # Start reading the models while we set up
+        prefetch_model_files(self.script_dir)
 
         # Load configuration and detect audio devices
         self.preferred_device_id = load_preferred_device_id(self.config_file)
@@ -308,6 +373,25 @@ class TranscriptionApp(QObject):
         self.populate_device_menu(device_menu)
         menu.addMenu(device_menu)
 
+        # Decoding profile submenu
+        profile_menu = QMenu("Decoding", menu)
+        profile_group = QActionGroup(self)
+        profile_group.setExclusive(True)
+        for name in DECODING_PROFILES:
+            action = QAction(name, self)
+            action.setCheckable(True)
+            action.setChecked(name == self.profile)
+            action.triggered.connect(lambda _checked, profile=name: self.set_profile(profile))
+            profile_group.addAction(action)
+            profile_menu.addAction(action)
+        menu.addMenu(profile_menu)
+
+        live_typing_action = QAction("Type While Speaking", self)
+        live_typing_action.setCheckable(True)
+        live_typing_action.setChecked(self.live_typing)
+        live_typing_action.triggered.connect(self.set_live_typing)
+        menu.addAction(live_typing_action)
+
         menu.addSeparator()
 
         # Quit action
@@ -350,6 +434,36 @@ class TranscriptionApp(QObject):
                 refresh_action.triggered.connect(self.refresh_and_update_menu)
                 device_menu.addAction(refresh_action)
 
+    def set_profile(self, profile):
+        """Switch decoding profile, live if we're transcribing"""
+        self.profile = profile
+        logger.info(f"User selected decoding profile: {profile}")
+        if self.transcribing:
+            for name, value in DECODING_PROFILES[profile].items():
+                self.send_control_command(f"set {name} {value}")
+
+        menu = self.create_context_menu()
+        self.tray_icon.setContextMenu(menu)
+
+    def set_live_typing(self, enabled):
+        """Type interim text and correct it, or wait for the end of each sentence"""
+        self.live_typing = enabled
+        logger.info(f"User set live typing: {enabled}")
+        # The output format is fixed when transcribe starts
+        if self.transcribing:
+            self.stop_transcription()
+            self.start_transcription()
+
+    def send_control_command(self, command):
+        """Send one command to the running transcribe binary"""
+        if not self.transcribe_process or not self.transcribe_process.stdin:
+            return
+        try:
+            self.transcribe_process.stdin.write(f"{command}\n".encode())
+            self.transcribe_process.stdin.flush()
+        except OSError as e:
+            logger.warning(f"Could not send '{command}' to transcribe: {e}")
+
     def refresh_and_update_menu(self):
         """Refresh devices and update the menu"""
         self.detect_audio_devices()
@@ -368,6 +482,29 @@ class TranscriptionApp(QObject):
         signal.signal(signal.SIGINT, self.signal_quit)
         signal.signal(signal.SIGTERM, self.signal_quit)
 
+        # Python only runs signal handlers when the interpreter gets control,
+        # which doesn't happen while Qt's event loop sleeps. Have Python write
+        # to a socket when a signal arrives and wake Qt on that, instead of
+        # polling with a timer.
+        self.signal_read_socket, signal_write_socket = socket.socketpair()
+        self.signal_read_socket.setblocking(False)
+        signal_write_socket.setblocking(False)
+        self.signal_write_socket = signal_write_socket
+        signal.set_wakeup_fd(signal_write_socket.fileno())
+
+        self.signal_notifier = QSocketNotifier(
+            self.signal_read_socket.fileno(), QSocketNotifier.Read, self
+        )
+        self.signal_notifier.activated.connect(self.drain_signal_socket)
+
+    def drain_signal_socket(self):
+        """Discard wakeup bytes; the Python signal handlers have already run"""
+        try:
+            while self.signal_read_socket.recv(64):
+                pass
+        except BlockingIOError:
+            pass
+
     def signal_quit(self, signum, _frame):
         logger.info(f"Received signal {signum}, quitting...")
         self.quit_app()
@@ -418,11 +555,13 @@ class TranscriptionApp(QObject):
 
             # Start the transcription pipeline in a subprocess
             # We use shell=True to handle the pipeline properly
-            cmd = build_transcribe_command(self.script_dir, active_device_id)
+            cmd = build_transcribe_command(self.script_dir, active_device_id, self.profile, self.live_typing)
 
+            # transcribe reads control commands from the pipeline's stdin
             self.transcribe_process = subprocess.Popen(
                 cmd,
                 shell=True,
+                stdin=subprocess.PIPE,
                 preexec_fn=os.setsid,  # Create new process group
             )
 
@@ -483,11 +622,6 @@ class TranscriptionApp(QObject):
 
     def run(self):
         """Run the application"""
-        # Timer to allow Unix signal handling in Qt event loop
-        timer = QTimer()
-        timer.timeout.connect(lambda: None)
-        timer.start(100)  # Check for signals every 100ms
-        
         try:
             sys.exit(self.app.exec_())
         except KeyboardInterrupt: